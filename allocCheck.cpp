@@ -0,0 +1,64 @@
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+#include "allocCheck.h"
+
+/*
+   glibc exports its allocator under __libc_* names, which lets us wrap the
+   public entry points without dlsym() (which itself allocates).
+*/
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void *__libc_memalign(size_t, size_t);
+}
+
+static std::atomic<uint64_t> allocations(0);
+
+uint64_t alloc_count(void) {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+extern "C" void *malloc(size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(n);
+}
+
+extern "C" void *calloc(size_t n, size_t sz) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, sz);
+}
+
+extern "C" void *realloc(void *p, size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, n);
+}
+
+static void *counted_new(size_t n) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = __libc_malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+static void *counted_new_aligned(size_t n, std::align_val_t al) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = __libc_memalign((size_t)al, n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t n) { return counted_new(n); }
+void *operator new[](size_t n) { return counted_new(n); }
+void *operator new(size_t n, std::align_val_t al) { return counted_new_aligned(n, al); }
+void *operator new[](size_t n, std::align_val_t al) { return counted_new_aligned(n, al); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { free(p); }
@@ -0,0 +1,14 @@
+#ifndef __ALLOC_CHECK
+#define __ALLOC_CHECK
+
+/*
+   Allocation counter for the serverA build. allocCheck.cpp interposes
+   malloc/calloc/realloc and operator new and counts every call, so the
+   server can assert that its steady-state path does not touch the heap.
+*/
+
+#include <stdint.h>
+
+uint64_t alloc_count(void); // Number of heap allocations made so far, all threads.
+
+#endif
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Goodput under loss: for each loss rate, run a fresh ./server behind
+# ./impair and drive it with ./loadgen, then report goodput (correct
+# exchanges/s), wasted server work and tail latency.
+#
+#   unanswered = jobs the server admitted but never saw a valid result for
+#                (lost assignments, retransmitted hellos, lost results)
+#   expired    = the part of those already reaped by the job TTL
+#
+# Usage: ./bench_loss.sh [clients] [seconds] [loss rates...]
+# Environment: DELAY, JITTER (ms, applied both ways), SEED, PORT.
+
+CLIENTS=${1:-16}
+SECONDS_PER_RUN=${2:-10}
+[ $# -gt 2 ] && shift 2 && RATES="$*"
+RATES=${RATES:-"0 0.01 0.02 0.05 0.1 0.2"}
+DELAY=${DELAY:-0}
+JITTER=${JITTER:-0}
+SEED=${SEED:-1}
+PORT=${PORT:-5610}
+SRV=127.0.0.1:$PORT
+PROXY=127.0.0.1:$((PORT + 1))
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+printf "%-6s %10s %8s %8s %8s %10s %8s %10s %10s\n" \
+    loss goodput ok not_ok failed retransmit unanswr expired p99_us
+for loss in $RATES; do
+    ./server $SRV > "$TMP/server" 2> /dev/null & srv=$!
+    ./impair $PROXY $SRV --loss "$loss" --delay "$DELAY" --jitter "$JITTER" --seed "$SEED" \
+        > /dev/null & imp=$!
+    sleep 0.3
+    ./loadgen $PROXY "$CLIENTS" "$SECONDS_PER_RUN" > "$TMP/loadgen"
+    kill $srv $imp; wait $srv $imp 2> /dev/null
+
+    awk -v loss="$loss" '
+        function val(k,   i) { for (i = 1; i <= NF; i++) if (index($i, k "=") == 1) return substr($i, length(k) + 2) }
+        /^exchanges/  { ok = val("ok"); nok = val("not_ok"); failed = val("failed"); rt = val("retransmits") }
+        /^throughput/ { gp = val("goodput") }
+        /^latency_us/ { p99 = val("p99") }
+        /^stats:/     { admitted = val("hellos_admitted"); served = val("results_served"); expired = val("jobs_expired") }
+        END { printf "%-6s %10.1f %8d %8d %8d %10d %8d %10d %10.0f\n",
+                     loss, gp, ok, nok, failed, rt, admitted - served, expired, p99 }
+    ' "$TMP/loadgen" "$TMP/server"
+done
@@ -0,0 +1,118 @@
+#ifndef __CALC_OPS
+#define __CALC_OPS
+
+/*
+   Operator registry for the arith codes in protocol.h. Header only, C++.
+
+   Every operation is defined exactly once, in OPS[] below: its protocol code,
+   its name, whether it works on the int or the float fields of calcProtocol,
+   the function that computes the reference result, and the tolerance used
+   when verifying a client's answer. OPS[] is indexed by the protocol code, so
+   dispatch is a bounds check plus an indirect call; no strings are involved.
+   Names are only needed when printing or parsing user input.
+
+   To add an operator, append a row to OPS[] with the next free code; the
+   server, client, loadgen and test program pick it up from here.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+namespace calcops {
+
+typedef int32_t (*IntFn)(int32_t, int32_t);
+typedef double (*FloatFn)(double, double);
+
+struct OpInfo {
+  uint32_t code;      // value of calcProtocol.arith
+  const char *name;   // as returned by calcLib's randomType()
+  bool is_float;      // operands/result in flValue*/flResult, else inValue*/inResult
+  IntFn ieval;        // set when !is_float
+  FloatFn feval;      // set when is_float
+  double tolerance;   // max |expected - submitted| accepted; 0 means exact
+};
+
+/* Division by zero yields 0 rather than trapping; the server has always done this.
+   Division by -1 negates with wrapping, so INT32_MIN / -1 is INT32_MIN instead of SIGFPE. */
+constexpr int32_t i_add(int32_t a, int32_t b) { return a + b; }
+constexpr int32_t i_sub(int32_t a, int32_t b) { return a - b; }
+constexpr int32_t i_mul(int32_t a, int32_t b) { return a * b; }
+constexpr int32_t i_div(int32_t a, int32_t b) {
+  return b == 0 ? 0 : b == -1 ? (int32_t)(0u - (uint32_t)a) : a / b;
+}
+constexpr double f_add(double a, double b) { return a + b; }
+constexpr double f_sub(double a, double b) { return a - b; }
+constexpr double f_mul(double a, double b) { return a * b; }
+constexpr double f_div(double a, double b) { return b == 0.0 ? 0.0 : a / b; }
+
+constexpr double FLOAT_TOLERANCE = 0.0001;
+
+constexpr OpInfo OPS[] = {
+  {0, "",     false, nullptr, nullptr, 0.0},  // 0 is reserved
+  {1, "add",  false, i_add,   nullptr, 0.0},
+  {2, "sub",  false, i_sub,   nullptr, 0.0},
+  {3, "mul",  false, i_mul,   nullptr, 0.0},
+  {4, "div",  false, i_div,   nullptr, 0.0},
+  {5, "fadd", true,  nullptr, f_add,   FLOAT_TOLERANCE},
+  {6, "fsub", true,  nullptr, f_sub,   FLOAT_TOLERANCE},
+  {7, "fmul", true,  nullptr, f_mul,   FLOAT_TOLERANCE},
+  {8, "fdiv", true,  nullptr, f_div,   FLOAT_TOLERANCE},
+};
+
+constexpr uint32_t OP_COUNT = sizeof(OPS) / sizeof(OPS[0]) - 1;
+
+constexpr bool table_is_consistent() {
+  for (uint32_t i = 1; i <= OP_COUNT; i++) {
+    if (OPS[i].code != i) return false;
+    if (OPS[i].is_float ? OPS[i].feval == nullptr : OPS[i].ieval == nullptr) return false;
+  }
+  return true;
+}
+static_assert(table_is_consistent(), "OPS[] must be indexed by code and have an eval function per row");
+
+/* Returns nullptr for reserved/unknown codes. */
+inline const OpInfo *lookup(uint32_t code) {
+  return (code >= 1 && code <= OP_COUNT) ? &OPS[code] : nullptr;
+}
+
+constexpr bool name_equals(const char *a, const char *b) {
+  while (*a && *a == *b) { a++; b++; }
+  return *a == *b;
+}
+
+/* Slow path, for parsing names typed by a user. */
+constexpr const OpInfo *lookup_name(const char *name) {
+  for (uint32_t i = 1; i <= OP_COUNT; i++) {
+    if (name_equals(OPS[i].name, name)) return &OPS[i];
+  }
+  return nullptr;
+}
+
+static_assert(lookup_name("fdiv")->code == 8, "name lookup");
+
+/* Uniformly random operator, drawn from rand() like calcLib's randomType(). */
+inline const OpInfo &random_op() {
+  return OPS[1 + rand() % OP_COUNT];
+}
+
+struct Value {
+  int32_t i;
+  double f;
+};
+
+inline Value eval(const OpInfo &op, int32_t i1, int32_t i2, double f1, double f2) {
+  Value v = {0, 0.0};
+  if (op.is_float) v.f = op.feval(f1, f2);
+  else v.i = op.ieval(i1, i2);
+  return v;
+}
+
+inline bool verify(const OpInfo &op, const Value &expected, const Value &submitted) {
+  if (op.is_float) return fabs(submitted.f - expected.f) < op.tolerance;
+  return submitted.i == expected.i;
+}
+
+}
+
+#endif
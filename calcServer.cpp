@@ -0,0 +1,324 @@
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <arpa/inet.h>
+#include "protocol.h"
+#include "calcServer.h"
+#include "calcLib.h"
+#include "calcOps.h"
+#include "directorProtocol.h"
+#include "journalWriter.h"
+#include "stageTrace.h"
+
+using namespace std;
+
+namespace calcserver {
+
+static_assert(sizeof(calcProtocol) <= OUT_MAX && sizeof(calcMessage) <= OUT_MAX, "OUT_MAX too small");
+
+const char *addr_to_string(const sockaddr_storage &ss, char *out) {
+    char host[INET6_ADDRSTRLEN] = {0};
+    unsigned port;
+    if (ss.ss_family == AF_INET) {
+        const sockaddr_in *s = (const sockaddr_in*)&ss;
+        inet_ntop(AF_INET, &s->sin_addr, host, sizeof(host));
+        port = ntohs(s->sin_port);
+    } else {
+        const sockaddr_in6 *s6 = (const sockaddr_in6*)&ss;
+        inet_ntop(AF_INET6, &s6->sin6_addr, host, sizeof(host));
+        port = ntohs(s6->sin6_port);
+    }
+    snprintf(out, ADDR_STR_LEN, "%s:%u", host, port);
+    return out;
+}
+
+bool same_sockaddr(const sockaddr_storage &a, const sockaddr_storage &b) {
+    if (a.ss_family != b.ss_family) return false;
+    if (a.ss_family == AF_INET) {
+        const sockaddr_in *pa = (const sockaddr_in*)&a;
+        const sockaddr_in *pb = (const sockaddr_in*)&b;
+        return pa->sin_port == pb->sin_port && pa->sin_addr.s_addr == pb->sin_addr.s_addr;
+    } else {
+        const sockaddr_in6 *pa = (const sockaddr_in6*)&a;
+        const sockaddr_in6 *pb = (const sockaddr_in6*)&b;
+        return pa->sin6_port == pb->sin6_port &&
+               memcmp(&pa->sin6_addr, &pb->sin6_addr, sizeof(in6_addr)) == 0;
+    }
+}
+
+static void verdict_message(Outbound &out, uint32_t message) {
+    calcMessage m{};
+    m.type = htons(1);
+    m.message = htonl(message); // 1 OK, 2 NOT OK
+    m.protocol = htons(17);
+    m.major_version = htons(1);
+    m.minor_version = htons(0);
+    memcpy(out.data, &m, sizeof(m));
+    out.len = sizeof(m);
+}
+
+Engine::Engine() : job_ttl(10000), window(), answered_frac(1.0), answer_p99_ms(0), adapted_once(false) {
+    memset(&st, 0, sizeof(st));
+}
+
+bool Engine::init(const Config &c) {
+    if (c.max_jobs == 0 || c.ttl_min > c.ttl_max || c.id_bits > 31) return false;
+    if ((1ull << (32 - c.id_bits)) <= c.max_jobs) return false;
+    cfg = c;
+    jobs.init(cfg.max_jobs);
+    memset(&st, 0, sizeof(st));
+    job_ttl = cfg.ttl_max;
+    window = TtlWindow();
+    answered_frac = 1.0;
+    answer_p99_ms = 0;
+    adapted_once = false;
+    return true;
+}
+
+size_t Engine::process(const Inbound *in, size_t n, Outbound *out, Clock::time_point now) {
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (handle(in[i], out[k], now)) out[k++].index = (uint32_t)i;
+    }
+    return k;
+}
+
+bool Engine::handle(const Inbound &in, Outbound &out, Clock::time_point now) {
+    TRACE_MARK(STAGE_DECODE);
+    st.datagrams++;
+    if (cfg.log) {
+        char client_str[ADDR_STR_LEN];
+        const char *from = in.addr_str ? in.addr_str : addr_to_string(*in.addr, client_str);
+        *cfg.log << "Received " << in.len << " bytes from " << from << endl;
+    }
+    TRACE_MARK(STAGE_LOG);
+
+    if (in.len == sizeof(calcMessage)) return hello(in, out, now);
+    if (in.len == sizeof(calcProtocol)) return result(in, out, now);
+    protocol_error(in);
+    return false;
+}
+
+void Engine::protocol_error(const Inbound &in) {
+    if (!cfg.log) return;
+    char client_str[ADDR_STR_LEN];
+    *cfg.log << "ERROR WRONG SIZE OR INCORRECT PROTOCOL from " << addr_to_string(*in.addr, client_str) << endl;
+}
+
+uint32_t Engine::new_id() {
+    uint32_t id;
+    do {
+        id = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        id = slice_id(cfg.id_prefix, cfg.id_bits, id);
+    } while (id == 0 || jobs.find(id) != nullptr);
+    return id;
+}
+
+bool Engine::hello(const Inbound &in, Outbound &out, Clock::time_point now) {
+    struct calcMessage cm;
+    memcpy(&cm, in.data, sizeof(cm));
+
+    uint16_t cm_type = ntohs(cm.type);
+    uint32_t cm_message = ntohl(cm.message);
+    uint16_t cm_protocol = ntohs(cm.protocol);
+    uint16_t cm_maj = ntohs(cm.major_version);
+    uint16_t cm_min = ntohs(cm.minor_version);
+
+    if (!(cm_type == 22 && cm_message == 0 && cm_protocol == 17 && cm_maj == 1 && cm_min == 0)) {
+        protocol_error(in);
+        return false;
+    }
+    TRACE_MARK(STAGE_DECODE);
+
+    struct calcProtocol cp;
+    memset(&cp, 0, sizeof(cp));
+    cp.type = htons(1); // server -> client
+    cp.major_version = htons(1);
+    cp.minor_version = htons(0);
+
+    if (jobs.full()) {
+        Job *oldest = jobs.oldest();
+        if (oldest == nullptr) return false; // no table: init() failed or was never called
+        drop_job(oldest, true, now);
+    }
+
+    uint32_t id = new_id();
+    cp.id = htonl(id);
+
+    const calcops::OpInfo &op = calcops::random_op();
+    cp.arith = htonl(op.code);
+
+    int32_t iv1 = 0, iv2 = 0;
+    double f1 = 0.0, f2 = 0.0;
+    if (op.is_float) {
+        f1 = randomFloat();
+        f2 = randomFloat();
+        cp.flValue1 = f1;
+        cp.flValue2 = f2;
+        cp.flResult = 0.0; // don't reveal expected result
+    } else {
+        iv1 = randomInt();
+        iv2 = randomInt();
+        cp.inValue1 = htonl(iv1);
+        cp.inValue2 = htonl(iv2);
+        cp.inResult = htonl(0); // don't reveal expected result
+    }
+    calcops::Value expected = calcops::eval(op, iv1, iv2, f1, f2);
+    TRACE_MARK(STAGE_COMPUTE);
+
+    Job *job = jobs.insert(id);
+    job->addr = *in.addr;
+    job->addrlen = in.addrlen;
+    job->arith = op.code;
+    job->peer = in.peer;
+    job->in1 = {iv1, f1};
+    job->in2 = {iv2, f2};
+    job->expected = expected;
+    job->ts = now;
+    job->deadline = now + job_ttl;
+    TRACE_MARK(STAGE_TABLE);
+
+    st.hellos_admitted++;
+    memcpy(out.data, &cp, sizeof(cp));
+    out.len = sizeof(cp);
+    TRACE_MARK(STAGE_ENCODE);
+    return true;
+}
+
+bool Engine::result(const Inbound &in, Outbound &out, Clock::time_point now) {
+    struct calcProtocol cp;
+    memcpy(&cp, in.data, sizeof(cp));
+
+    uint16_t type = ntohs(cp.type);
+    uint16_t maj = ntohs(cp.major_version);
+    uint16_t min = ntohs(cp.minor_version);
+    uint32_t id = ntohl(cp.id);
+
+    if (!(type == 2 && maj == 1 && min == 0)) {
+        protocol_error(in);
+        return false;
+    }
+    TRACE_MARK(STAGE_DECODE);
+
+    Job *job = jobs.find(id);
+    if (job == nullptr || !((in.peer != 0 && job->peer == in.peer) || same_sockaddr(job->addr, *in.addr))) {
+        verdict_message(out, 2);
+        return true;
+    }
+    if (now >= job->deadline) {
+        drop_job(job, false, now);
+        verdict_message(out, 2);
+        return true;
+    }
+    TRACE_MARK(STAGE_TABLE);
+
+    calcops::Value submitted = {(int32_t)ntohl((uint32_t)cp.inResult), cp.flResult};
+    bool ok = calcops::verify(calcops::OPS[job->arith], job->expected, submitted);
+    TRACE_MARK(STAGE_COMPUTE);
+
+    record_answer(*job, now);
+    journal_job(*job, ok ? JOURNAL_OK : JOURNAL_NOT_OK, submitted, now);
+    jobs.erase(job);
+    st.results_served++;
+    TRACE_MARK(STAGE_TABLE);
+
+    verdict_message(out, ok ? 1 : 2);
+    TRACE_MARK(STAGE_ENCODE);
+    return true;
+}
+
+// Append <job>'s outcome to the journal, if one is configured.
+void Engine::journal_job(const Job &job, uint8_t verdict, const calcops::Value &submitted, Clock::time_point now) {
+    if (!cfg.journal) return;
+    journalRecord *r = cfg.journal->reserve();
+    if (r == nullptr) return;
+    timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    r->time_ns = (uint64_t)wall.tv_sec * 1000000000ull + wall.tv_nsec;
+    r->id = job.id;
+    r->latency_us = (uint32_t)chrono::duration_cast<chrono::microseconds>(now - job.ts).count();
+    r->arith = (uint8_t)job.arith;
+    r->verdict = verdict;
+    journal_encode_addr(*r, job.addr);
+    r->reserved = 0;
+    r->in1 = job.in1.i;
+    r->in2 = job.in2.i;
+    r->in_expected = job.expected.i;
+    r->in_submitted = submitted.i;
+    r->fl1 = job.in1.f;
+    r->fl2 = job.in2.f;
+    r->fl_expected = job.expected.f;
+    r->fl_submitted = submitted.f;
+    cfg.journal->commit();
+}
+
+void Engine::record_answer(const Job &job, Clock::time_point now) {
+    uint64_t ms = (uint64_t)chrono::duration_cast<chrono::milliseconds>(now - job.ts).count();
+    int b = ms == 0 ? 0 : 64 - __builtin_clzll(ms);
+    window.answer_ms[b < ANSWER_BUCKETS ? b : ANSWER_BUCKETS - 1]++;
+    window.answered++;
+}
+
+// Remove a job that will not be answered: it outlived its deadline, or
+// (<evicted>) the table needed its slot.
+void Engine::drop_job(Job *job, bool evicted, Clock::time_point now) {
+    if (evicted) {
+        if (cfg.job_log) *cfg.job_log << "Job " << job->id << " evicted, job table full." << endl;
+        st.jobs_evicted++;
+    } else {
+        if (cfg.job_log) *cfg.job_log << "Job " << job->id << " timed out and removed." << endl;
+        st.jobs_expired++;
+    }
+    window.unanswered++;
+    journal_job(*job, evicted ? JOURNAL_EVICTED : JOURNAL_EXPIRED, calcops::Value{0, 0.0}, now);
+    jobs.erase(job);
+}
+
+// Jobs are reaped in creation order. Deadlines are not quite monotonic in
+// that order because the TTL adapts, so a result that arrives after its
+// job's deadline is also refused on lookup.
+void Engine::advance(Clock::time_point now) {
+    while (Job *job = jobs.oldest()) {
+        if (now < job->deadline) break;
+        drop_job(job, false, now);
+    }
+    if (!adapted_once) {
+        adapted_once = true;
+        last_adapt = now;
+    } else if (now - last_adapt >= chrono::milliseconds(TTL_ADAPT_MS)) {
+        last_adapt = now;
+        adapt_ttl();
+    }
+}
+
+void Engine::adapt_ttl() {
+    TtlWindow &w = window;
+    const double lo = (double)cfg.ttl_min.count(), hi = (double)cfg.ttl_max.count();
+    double target_ms = (double)job_ttl.count();
+    if (w.answered > 0) {
+        uint64_t rank = w.answered - w.answered / 100, seen = 0;
+        int b = 0;
+        while (b < ANSWER_BUCKETS - 1 && (seen += w.answer_ms[b]) < rank) b++;
+        answer_p99_ms = 1ull << b; // upper bound of the bucket
+        answered_frac = (double)w.answered / (w.answered + w.unanswered);
+        target_ms = (1.0 + answered_frac) * answer_p99_ms;
+    } else if (w.unanswered > 0) {
+        answer_p99_ms = 0;
+        answered_frac = 0.0;
+        target_ms = lo;
+    }
+    double occupancy = jobs.capacity() ? (double)jobs.size() / jobs.capacity() : 0.0;
+    if (occupancy > TTL_PRESSURE) {
+        double squeeze = (1.0 - occupancy) / (1.0 - TTL_PRESSURE);
+        target_ms = lo + (target_ms - lo) * squeeze;
+    }
+    if (target_ms < lo) target_ms = lo;
+    if (target_ms > hi) target_ms = hi;
+    job_ttl = chrono::milliseconds((int64_t)((job_ttl.count() + target_ms) / 2));
+    if (job_ttl < cfg.ttl_min) job_ttl = cfg.ttl_min;
+    if (job_ttl > cfg.ttl_max) job_ttl = cfg.ttl_max;
+
+    w = TtlWindow();
+}
+
+}
@@ -0,0 +1,151 @@
+#ifndef __CALC_SERVER
+#define __CALC_SERVER
+
+/*
+   libcalcserver: the calc protocol engine without any I/O. C++.
+
+   An Engine owns the job table. process() turns a batch of inbound datagrams
+   (a calcMessage hello or a calcProtocol result, plus the client address it
+   came from) into replies; advance() expires jobs and adapts the job TTL.
+   Time is always passed in: the engine never reads the steady clock (journal
+   records carry a wall-clock stamp), touches a socket or keeps global state,
+   so several engines can live in one process and the transport around it
+   decides how datagrams move. ./server drives one from UDP sockets
+   (recvmmsg/sendmmsg, GRO/GSO, director framing, connected peers),
+   ./enginebench from in-memory buffers. Operands and ids still come from
+   calcLib/rand(), the only state engines share.
+
+   After init(), neither process() nor advance() allocates. An Engine is not
+   thread-safe; callers serialise access to it.
+
+   Job lifetime: every job gets a deadline of now + ttl() when it is created.
+   Once per TTL_ADAPT_MS the TTL moves halfway towards a target of
+   (1 + answered fraction) x the p99 time to answer over the last interval:
+   when most jobs are never answered it hugs the real answer time, when they
+   all are it leaves 2x headroom for retransmitted results. Above
+   TTL_PRESSURE table occupancy the target shrinks linearly to ttl_min at a
+   full table. It always stays within [ttl_min, ttl_max]. Only first-try
+   answers are timed, so a healthy server converges to ttl_min, which must
+   therefore cover the clients' retry window. When the table is full a new
+   hello evicts the oldest unanswered job instead of being refused.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#include <ostream>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "jobTable.h"
+
+class JournalWriter;
+
+namespace calcserver {
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+  uint32_t max_jobs = 65536;
+  std::chrono::milliseconds ttl_min{6000}, ttl_max{10000};  // floor >= client retry window
+  uint32_t id_prefix = 0, id_bits = 0;  // id slicing, see directorProtocol.h
+  JournalWriter *journal = nullptr;     // every finished job is journaled, if set
+  std::ostream *log = nullptr;          // one line per datagram / protocol error, if set
+  std::ostream *job_log = nullptr;      // one line per expired or evicted job, if set
+};
+
+struct Stats {
+  uint64_t datagrams;
+  uint64_t results_served;
+  uint64_t hellos_admitted;
+  uint64_t jobs_expired;   // not answered within their TTL
+  uint64_t jobs_evicted;   // dropped unanswered to make room for a new job
+};
+
+// <peer> lets a transport vouch for the source address: a nonzero token
+// says the datagram arrived on a socket connected to *addr. Tokens must not
+// be reused for another address. Results from the peer that created a job
+// then match it by token, without comparing addresses. <addr_str> spares
+// the per-datagram formatting of *addr for the log.
+struct Inbound {
+  const unsigned char *data;
+  size_t len;
+  const sockaddr_storage *addr;  // the client; replies go back to it
+  socklen_t addrlen;
+  uint32_t peer;                 // transport peer token, 0 = none
+  const char *addr_str;          // *addr formatted by addr_to_string(), or nullptr
+};
+
+static const size_t OUT_MAX = 64;  // >= sizeof(calcProtocol), checked in calcServer.cpp
+
+struct Outbound {
+  uint32_t index;                // position of the Inbound this answers
+  uint16_t len;
+  unsigned char data[OUT_MAX];   // calcProtocol assignment or calcMessage verdict
+};
+
+// Formats "host:port" into <out>, which should hold ADDR_STR_LEN bytes.
+static const size_t ADDR_STR_LEN = INET6_ADDRSTRLEN + 8;
+const char *addr_to_string(const sockaddr_storage &ss, char *out);
+bool same_sockaddr(const sockaddr_storage &a, const sockaddr_storage &b);
+
+class Engine {
+public:
+  static constexpr int TTL_ADAPT_MS = 1000;
+  static constexpr double TTL_PRESSURE = 0.75;
+  static constexpr int ANSWER_BUCKETS = 24;  // log2 buckets of answer time in ms
+
+  Engine();
+
+  // False, leaving the engine unusable, if <cfg> has no room for a job,
+  // ttl_min > ttl_max, or the id slice has no more ids than the table has
+  // slots (new ids are drawn until one is free).
+  bool init(const Config &cfg);
+
+  // Handle <n> datagrams; <out> must have room for <n> replies, at most one
+  // per datagram. Returns the number of replies written.
+  size_t process(const Inbound *in, size_t n, Outbound *out, Clock::time_point now);
+
+  // Single-datagram form of process(); true if <out> holds a reply.
+  bool handle(const Inbound &in, Outbound &out, Clock::time_point now);
+
+  // Expire jobs past their deadline and, every TTL_ADAPT_MS, adapt the TTL.
+  void advance(Clock::time_point now);
+
+  uint32_t size() const { return jobs.size(); }
+  uint32_t capacity() const { return jobs.capacity(); }
+  uint64_t memory() const { return jobs.memory(); }
+  std::chrono::milliseconds ttl() const { return job_ttl; }
+  std::chrono::milliseconds max_ttl() const { return cfg.ttl_max; }
+  double answered_fraction() const { return answered_frac; }
+  uint64_t answer_p99() const { return answer_p99_ms; }  // ms, 0 = no answers
+  const Stats &stats() const { return st; }
+
+private:
+  struct TtlWindow {
+    uint64_t answered, unanswered;
+    uint64_t answer_ms[ANSWER_BUCKETS];  // bucket b holds [2^(b-1), 2^b) ms
+  };
+
+  Config cfg;
+  JobTable jobs;
+  Stats st;
+  std::chrono::milliseconds job_ttl;
+  TtlWindow window;
+  double answered_frac;
+  uint64_t answer_p99_ms;
+  Clock::time_point last_adapt;
+  bool adapted_once;
+
+  uint32_t new_id();
+  bool hello(const Inbound &in, Outbound &out, Clock::time_point now);
+  bool result(const Inbound &in, Outbound &out, Clock::time_point now);
+  void protocol_error(const Inbound &in);
+  void journal_job(const Job &job, uint8_t verdict, const calcops::Value &submitted, Clock::time_point now);
+  void record_answer(const Job &job, Clock::time_point now);
+  void drop_job(Job *job, bool evicted, Clock::time_point now);
+  void adapt_ttl();
+};
+
+}
+
+#endif
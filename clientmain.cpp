@@ -12,6 +12,8 @@
 
 #include <calcLib.h>
 #include "protocol.h" 
+#include "calcOps.h"
+#include "hostPort.h"
 
 using namespace std;
 
@@ -20,27 +22,6 @@ using namespace std;
 #else
 #define DEBUG_PRINT(x) do {} while(0)
 #endif
-bool splitHostPort(string input, string &host, string &port) {
-    if (input.empty()) return false;
-
-    if (input[0] == '[') {
-        size_t pos = input.find(']');
-        if (pos == string::npos || pos + 1 >= input.size() || input[pos+1] != ':') {
-            return false;
-        }
-        host = input.substr(1, pos - 1);
-        port = input.substr(pos + 2);
-    } else {
-        size_t pos = input.rfind(':');
-        if (pos == string::npos) {
-            return false;
-        }
-        host = input.substr(0, pos);
-        port = input.substr(pos + 1);
-    }
-    return true;
-}
-
 int sendWithRetry(int sock, const void *msg, size_t msgSize,
                   void *reply, size_t replySize,
                   struct sockaddr *serverAddr, socklen_t addrLen) {
@@ -182,30 +163,24 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    int op = assignment.arith;
-    bool isFloat = (op >= 5);
-    int intRes = 0;
-    double floatRes = 0.0;
+    const calcops::OpInfo *op = calcops::lookup(assignment.arith);
+    if (!op) {
+        cout << "ERROR WRONG SIZE OR INCORRECT PROTOCOL" << endl;
+        close(sock);
+        freeaddrinfo(res);
+        return 1;
+    }
+    bool isFloat = op->is_float;
+    calcops::Value result = calcops::eval(*op, assignment.inValue1, assignment.inValue2,
+                                          assignment.flValue1, assignment.flValue2);
+    int intRes = result.i;
+    double floatRes = result.f;
 
     if (!isFloat) {
-        int a = assignment.inValue1;
-        int b = assignment.inValue2;
-        string opName;
-        if (op == 1) { intRes = a + b; opName = "add"; }
-        else if (op == 2) { intRes = a - b; opName = "sub"; }
-        else if (op == 3) { intRes = a * b; opName = "mul"; }
-        else if (op == 4) { intRes = a / b; opName = "div"; }
-        cout << "ASSIGNMENT: " << opName << " " << a << " " << b << endl;
+        cout << "ASSIGNMENT: " << op->name << " " << assignment.inValue1 << " " << assignment.inValue2 << endl;
         DEBUG_PRINT("Calculated the result to " << intRes);
     } else {
-        double a = assignment.flValue1;
-        double b = assignment.flValue2;
-        string opName;
-        if (op == 5) { floatRes = a + b; opName = "fadd"; }
-        else if (op == 6) { floatRes = a - b; opName = "fsub"; }
-        else if (op == 7) { floatRes = a * b; opName = "fmul"; }
-        else if (op == 8) { floatRes = a / b; opName = "fdiv"; }
-        cout << "ASSIGNMENT: " << opName << " " << a << " " << b << endl;
+        cout << "ASSIGNMENT: " << op->name << " " << assignment.flValue1 << " " << assignment.flValue2 << endl;
         DEBUG_PRINT("Calculated the result to " << floatRes);
     }
 
@@ -0,0 +1,377 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <csignal>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "directorProtocol.h"
+#include "hostPort.h"
+
+/*
+   UDP front end for several server processes.
+
+   Clients talk to the director as if it were a server. Hellos go to the
+   healthy, non-draining backend with the least load (live jobs it last
+   reported plus hellos sent to it since). Results go to the backend whose
+   slice the job id falls in, so every result lands on the process that
+   issued the job. Traffic to and from backends is framed with a
+   directorHeader carrying the client's address, and moved in recvmmsg/
+   sendmmsg batches on both sides.
+
+   Backends are probed every PROBE_MS; one that has not answered for
+   DEAD_MS, or whose socket reports an ICMP error, gets no new hellos until
+   it answers again. A backend that reports
+   it is draining (SIGTERM) gets no new hellos but still gets its results.
+
+   Usage: ./director <IP:PORT> <backend IP:PORT> [<backend IP:PORT> ...]
+   Backend K (0-based, in the order given) must run as
+          ./server <backend IP:PORT> --director --id-slice K/N
+   SIGUSR1 prints per-backend counters.
+ */
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static const int BATCH = 64;
+static const int PROBE_MS = DIR_PROBE_MS;
+static const int DEAD_MS = 1500;
+static const size_t FRAME_MAX = sizeof(directorHeader) + sizeof(calcProtocol);
+
+struct OutBatch {
+    mmsghdr msgs[BATCH];
+    iovec iovs[BATCH];
+    sockaddr_storage addrs[BATCH];
+    unsigned char bufs[BATCH][FRAME_MAX];
+    int n;
+};
+
+struct Backend {
+    string name;
+    int sock;              // connected to the backend
+    bool healthy;
+    bool draining;
+    uint32_t load;         // live jobs at the last probe reply
+    uint32_t pending;      // hellos sent since the last probe reply
+    Clock::time_point last_reply;
+    uint64_t hellos, results, replies, send_drops;
+    uint64_t errors;       // ICMP errors (e.g. port unreachable) on the connected socket
+    OutBatch out;
+};
+
+static volatile sig_atomic_t stop_director = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+static void handle_sig(int) { stop_director = 1; }
+static void handle_usr1(int) { dump_requested = 1; }
+
+// Open a non-blocking UDP socket bound to (listen) or connected to <hostport>.
+static int open_socket(const string &hostport, bool listen) {
+    string host, port;
+    if (!splitHostPort(hostport, host, port)) {
+        cerr << "Invalid address " << hostport << endl;
+        return -1;
+    }
+    struct addrinfo hints, *res, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (rc != 0) {
+        cerr << "getaddrinfo " << hostport << ": " << gai_strerror(rc) << endl;
+        return -1;
+    }
+    int sock = -1;
+    for (rp = res; rp != nullptr; rp = rp->ai_next) {
+        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock < 0) continue;
+        int ok = listen ? bind(sock, rp->ai_addr, rp->ai_addrlen)
+                        : connect(sock, rp->ai_addr, rp->ai_addrlen);
+        if (ok == 0) break;
+        close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    if (sock < 0) {
+        perror(hostport.c_str());
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    return sock;
+}
+
+// Slot for one more outgoing datagram; <to> may be null on a connected socket.
+static unsigned char *out_slot(OutBatch &b, const sockaddr_storage *to, socklen_t tolen, size_t len) {
+    int i = b.n++;
+    b.iovs[i].iov_base = b.bufs[i];
+    b.iovs[i].iov_len = len;
+    msghdr &mh = b.msgs[i].msg_hdr;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &b.iovs[i];
+    mh.msg_iovlen = 1;
+    if (to) {
+        b.addrs[i] = *to;
+        mh.msg_name = &b.addrs[i];
+        mh.msg_namelen = tolen;
+    }
+    return b.bufs[i];
+}
+
+// Send the whole batch; returns how many datagrams the kernel refused.
+static uint64_t flush(int sock, OutBatch &b) {
+    uint64_t dropped = 0;
+    int off = 0;
+    while (off < b.n) {
+        int r = sendmmsg(sock, b.msgs + off, b.n - off, 0);
+        if (r > 0) {
+            off += r;
+        } else if (r < 0 && errno == EINTR) {
+            continue;
+        } else {
+            dropped++;
+            off++;
+        }
+    }
+    b.n = 0;
+    return dropped;
+}
+
+static void send_probe(Backend &be) {
+    directorHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = htons(DIRECTOR_MAGIC);
+    h.kind = DIR_PROBE;
+    send(be.sock, &h, sizeof(h), 0);
+}
+
+static Backend *pick_for_hello(vector<Backend> &backends) {
+    Backend *best = nullptr;
+    for (auto &be : backends) {
+        if (!be.healthy || be.draining) continue;
+        if (!best || be.load + be.pending < best->load + best->pending) best = &be;
+    }
+    return best;
+}
+
+static void dump(const vector<Backend> &backends, uint64_t no_backend, uint64_t bad, uint64_t client_drops) {
+    for (size_t k = 0; k < backends.size(); k++) {
+        const Backend &be = backends[k];
+        cout << "backend " << k << " " << be.name
+             << (be.healthy ? " up" : " DOWN") << (be.draining ? " draining" : "")
+             << " load=" << be.load << " hellos=" << be.hellos << " results=" << be.results
+             << " replies=" << be.replies << " send_drops=" << be.send_drops
+             << " errors=" << be.errors << endl;
+    }
+    cout << "hellos without backend=" << no_backend << " unroutable/bad=" << bad
+         << " client_send_drops=" << client_drops << endl;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        cout << "Usage: ./director <IP:PORT> <backend IP:PORT> [<backend IP:PORT> ...]" << endl;
+        return 1;
+    }
+
+    int front = open_socket(argv[1], true);
+    if (front < 0) return 1;
+
+    uint32_t nbackends = argc - 2;
+    uint32_t bits = slice_bits(nbackends);
+    vector<Backend> backends(nbackends);
+    auto start = Clock::now();
+    for (uint32_t k = 0; k < nbackends; k++) {
+        Backend &be = backends[k];
+        be.name = argv[k + 2];
+        be.sock = open_socket(be.name, false);
+        if (be.sock < 0) return 1;
+        be.healthy = true; // until it misses probes
+        be.draining = false;
+        be.load = be.pending = 0;
+        be.last_reply = start;
+        be.hellos = be.results = be.replies = be.send_drops = be.errors = 0;
+        be.out.n = 0;
+    }
+
+    signal(SIGINT, handle_sig);
+    signal(SIGTERM, handle_sig);
+    signal(SIGUSR1, handle_usr1);
+
+    cout << "Director on " << argv[1] << " for " << nbackends << " backends ("
+         << bits << " id bits)" << endl;
+
+    static unsigned char bufs[BATCH][2048];
+    static sockaddr_storage addrs[BATCH];
+    static mmsghdr msgs[BATCH];
+    static iovec iovs[BATCH];
+    static OutBatch to_clients;
+    to_clients.n = 0;
+
+    vector<pollfd> pfds(nbackends + 1);
+    pfds[0].fd = front;
+    pfds[0].events = POLLIN;
+    for (uint32_t k = 0; k < nbackends; k++) {
+        pfds[k + 1].fd = backends[k].sock;
+        pfds[k + 1].events = POLLIN;
+    }
+
+    uint64_t no_backend = 0, bad = 0, client_drops = 0; // client_drops: replies the kernel refused
+    auto last_probe = start - chrono::milliseconds(PROBE_MS);
+
+    while (!stop_director) {
+        int pr = poll(pfds.data(), pfds.size(), 100);
+        if (pr < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        auto now = Clock::now();
+
+        if (now - last_probe >= chrono::milliseconds(PROBE_MS)) {
+            last_probe = now;
+            for (auto &be : backends) {
+                bool alive = now - be.last_reply < chrono::milliseconds(DEAD_MS);
+                if (be.healthy && !alive) cout << "backend " << be.name << " is DOWN" << endl;
+                be.healthy = be.healthy && alive; // only a probe reply brings it back
+                send_probe(be);
+            }
+        }
+        if (dump_requested) {
+            dump_requested = 0;
+            dump(backends, no_backend, bad, client_drops);
+        }
+        if (pr <= 0) continue;
+
+        for (int i = 0; i < BATCH; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = sizeof(bufs[i]);
+            memset(&msgs[i].msg_hdr, 0, sizeof(msghdr));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // client -> backend
+        if (pfds[0].revents & POLLIN) {
+            int r = recvmmsg(front, msgs, BATCH, MSG_DONTWAIT, nullptr);
+            for (int i = 0; i < r; i++) {
+                size_t n = msgs[i].msg_len;
+                Backend *be = nullptr;
+                if (n == sizeof(calcMessage)) {
+                    be = pick_for_hello(backends);
+                    if (!be) {
+                        no_backend++; // client will retry
+                        continue;
+                    }
+                    be->pending++;
+                    be->hellos++;
+                } else if (n == sizeof(calcProtocol)) {
+                    calcProtocol cp;
+                    memcpy(&cp, bufs[i], sizeof(cp));
+                    uint32_t k = slice_of(ntohl(cp.id), bits);
+                    if (k >= nbackends) {
+                        // no backend issued this id; answer like a server would
+                        calcMessage resp;
+                        memset(&resp, 0, sizeof(resp));
+                        resp.type = htons(1);
+                        resp.message = htonl(2); // NOT OK
+                        resp.protocol = htons(17);
+                        resp.major_version = htons(1);
+                        resp.minor_version = htons(0);
+                        if (to_clients.n == BATCH) client_drops += flush(front, to_clients);
+                        memcpy(out_slot(to_clients, &addrs[i], msgs[i].msg_hdr.msg_namelen, sizeof(resp)),
+                               &resp, sizeof(resp));
+                        bad++;
+                        continue;
+                    }
+                    be = &backends[k];
+                    be->results++;
+                } else {
+                    bad++;
+                    continue;
+                }
+
+                directorHeader h;
+                memset(&h, 0, sizeof(h));
+                h.magic = htons(DIRECTOR_MAGIC);
+                h.kind = DIR_RELAY;
+                dir_encode_addr(h, addrs[i]);
+                if (be->out.n == BATCH) be->send_drops += flush(be->sock, be->out);
+                unsigned char *dst = out_slot(be->out, nullptr, 0, sizeof(h) + n);
+                memcpy(dst, &h, sizeof(h));
+                memcpy(dst + sizeof(h), bufs[i], n);
+            }
+            for (auto &be : backends) {
+                if (be.out.n) be.send_drops += flush(be.sock, be.out);
+            }
+        }
+
+        // backend -> client
+        for (uint32_t k = 0; k < nbackends; k++) {
+            Backend &be = backends[k];
+            if (pfds[k + 1].revents & POLLERR) {
+                // The pending error stays set, and poll() keeps reporting
+                // it, until it is read.
+                int err = 0;
+                socklen_t errlen = sizeof(err);
+                getsockopt(be.sock, SOL_SOCKET, SO_ERROR, &err, &errlen);
+                be.errors++;
+                if (be.healthy) cout << "backend " << be.name << " is DOWN (" << strerror(err) << ")" << endl;
+                be.healthy = false;
+            }
+            if (!(pfds[k + 1].revents & POLLIN)) continue;
+            int r = recvmmsg(be.sock, msgs, BATCH, MSG_DONTWAIT, nullptr);
+            for (int i = 0; i < r; i++) {
+                size_t n = msgs[i].msg_len;
+                directorHeader h;
+                if (n < sizeof(h)) {
+                    bad++;
+                    continue;
+                }
+                memcpy(&h, bufs[i], sizeof(h));
+                if (ntohs(h.magic) != DIRECTOR_MAGIC) {
+                    bad++;
+                    continue;
+                }
+                if (h.kind == DIR_PROBE_REPLY) {
+                    if (!be.healthy) cout << "backend " << be.name << " is up" << endl;
+                    be.healthy = true;
+                    be.draining = (h.flags & DIR_FLAG_DRAINING) != 0;
+                    be.load = ntohl(h.load);
+                    be.pending = 0;
+                    be.last_reply = now;
+                    continue;
+                }
+                sockaddr_storage client;
+                socklen_t client_len;
+                if (h.kind != DIR_RELAY || n - sizeof(h) > sizeof(calcProtocol) ||
+                    !dir_decode_addr(h, client, client_len)) {
+                    bad++;
+                    continue;
+                }
+                be.last_reply = now;
+                be.replies++;
+                if (to_clients.n == BATCH) client_drops += flush(front, to_clients);
+                memcpy(out_slot(to_clients, &client, client_len, n - sizeof(h)),
+                       bufs[i] + sizeof(h), n - sizeof(h));
+            }
+        }
+        if (to_clients.n) client_drops += flush(front, to_clients);
+    }
+
+    dump(backends, no_backend, bad, client_drops);
+    for (auto &be : backends) close(be.sock);
+    close(front);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#ifndef __DIRECTOR_PROTOCOL
+#define __DIRECTOR_PROTOCOL
+
+/*
+   Framing between ./director and the servers behind it (server --director).
+
+   Every datagram on the director <-> server leg starts with a directorHeader.
+   For relayed client traffic (kind 1) the header carries the client's address
+   and is followed by the unmodified calcMessage/calcProtocol; the server
+   treats that address as the client's identity and sends its reply back to
+   the director with the same header, so the director knows where it goes.
+   Health probes (kind 2) carry no payload; the server answers with kind 3,
+   reporting its live job count and whether it is draining.
+
+   Job ids are sliced: with N backends, the top slice_bits(N) bits of every id
+   issued by backend K are K (server --id-slice K/N), so the director routes a
+   result to the backend that issued it from the id alone.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DIRECTOR_MAGIC 0xCA1C
+
+enum {
+  DIR_RELAY = 1,        // client datagram, either direction
+  DIR_PROBE = 2,        // director -> server health check
+  DIR_PROBE_REPLY = 3   // server -> director, load + flags
+};
+
+#define DIR_FLAG_DRAINING 0x01
+#define DIR_PROBE_MS 500       // the director probes every backend this often
+
+struct __attribute__((__packed__)) directorHeader {
+  uint16_t magic;    // DIRECTOR_MAGIC, conversion needed
+  uint8_t kind;      // DIR_RELAY, DIR_PROBE, DIR_PROBE_REPLY
+  uint8_t flags;     // DIR_PROBE_REPLY: DIR_FLAG_DRAINING
+  uint16_t family;   // client address family, 4 or 6, conversion needed
+  uint16_t port;     // client port, already network order
+  uint8_t addr[16];  // client address, network order; IPv4 uses the first 4 bytes
+  uint32_t load;     // DIR_PROBE_REPLY: live jobs on the server, conversion needed
+};
+
+/* Number of id bits needed to tell <backends> backends apart. */
+inline uint32_t slice_bits(uint32_t backends) {
+  uint32_t bits = 0;
+  while ((1u << bits) < backends) bits++;
+  return bits;
+}
+
+/* Force the top <bits> bits of <random> to <prefix>. */
+inline uint32_t slice_id(uint32_t prefix, uint32_t bits, uint32_t random) {
+  if (bits == 0) return random;
+  return (prefix << (32 - bits)) | (random & (0xffffffffu >> bits));
+}
+
+inline uint32_t slice_of(uint32_t id, uint32_t bits) {
+  return bits == 0 ? 0 : id >> (32 - bits);
+}
+
+/* Fill the address fields of <h> from <ss>; the rest is left alone. */
+inline void dir_encode_addr(directorHeader &h, const sockaddr_storage &ss) {
+  memset(h.addr, 0, sizeof(h.addr));
+  if (ss.ss_family == AF_INET) {
+    const sockaddr_in *s = (const sockaddr_in*)&ss;
+    h.family = htons(4);
+    h.port = s->sin_port;
+    memcpy(h.addr, &s->sin_addr, 4);
+  } else {
+    const sockaddr_in6 *s6 = (const sockaddr_in6*)&ss;
+    h.family = htons(6);
+    h.port = s6->sin6_port;
+    memcpy(h.addr, &s6->sin6_addr, 16);
+  }
+}
+
+/* Inverse of dir_encode_addr(); returns false for an unknown family. */
+inline bool dir_decode_addr(const directorHeader &h, sockaddr_storage &ss, socklen_t &len) {
+  memset(&ss, 0, sizeof(ss));
+  if (ntohs(h.family) == 4) {
+    sockaddr_in *s = (sockaddr_in*)&ss;
+    s->sin_family = AF_INET;
+    s->sin_port = h.port;
+    memcpy(&s->sin_addr, h.addr, 4);
+    len = sizeof(sockaddr_in);
+    return true;
+  }
+  if (ntohs(h.family) == 6) {
+    sockaddr_in6 *s6 = (sockaddr_in6*)&ss;
+    s6->sin6_family = AF_INET6;
+    s6->sin6_port = h.port;
+    memcpy(&s6->sin6_addr, h.addr, 16);
+    len = sizeof(sockaddr_in6);
+    return true;
+  }
+  return false;
+}
+
+#endif
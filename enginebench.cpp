@@ -0,0 +1,146 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <chrono>
+#include <vector>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "protocol.h"
+#include "calcLib.h"
+#include "calcOps.h"
+#include "calcServer.h"
+
+/*
+   In-process benchmark of the protocol engine (libcalcserver), with an
+   in-memory transport instead of sockets. <clients> virtual clients, each
+   with its own fake address, run hello -> assignment -> result -> verdict
+   in lockstep: every round collects one pending datagram per client into
+   batches of [batch], hands each batch to Engine::process(), and feeds the
+   replies back to the clients they belong to. advance() runs every 1000
+   batches. No kernel is involved, so the numbers are the engine's own cost.
+
+   Usage: ./enginebench [clients] [seconds] [batch]
+ */
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+struct VClient {
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    uint16_t len;                       // pending datagram, 0 = none
+    unsigned char data[sizeof(calcProtocol)];
+};
+
+static void make_hello(VClient &c) {
+    calcMessage hello{};
+    hello.type = htons(22);
+    hello.message = htonl(0);
+    hello.protocol = htons(17);
+    hello.major_version = htons(1);
+    hello.minor_version = htons(0);
+    memcpy(c.data, &hello, sizeof(hello));
+    c.len = sizeof(hello);
+}
+
+// Build the answer to an assignment; returns false if it is malformed.
+static bool make_answer(VClient &c, const unsigned char *data) {
+    calcProtocol in, out;
+    memcpy(&in, data, sizeof(in));
+    const calcops::OpInfo *op = calcops::lookup(ntohl(in.arith));
+    if (!op || ntohs(in.type) != 1) return false;
+    out = in;
+    out.type = htons(2);
+    calcops::Value v = calcops::eval(*op, (int32_t)ntohl(in.inValue1), (int32_t)ntohl(in.inValue2),
+                                     in.flValue1, in.flValue2);
+    out.inResult = htonl(v.i);
+    out.flResult = v.f;
+    memcpy(c.data, &out, sizeof(out));
+    c.len = sizeof(out);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int nclients = argc > 1 ? atoi(argv[1]) : 1024;
+    double seconds = argc > 2 ? atof(argv[2]) : 3.0;
+    int batch = argc > 3 ? atoi(argv[3]) : 64;
+    if (nclients <= 0 || seconds <= 0 || batch <= 0) {
+        cout << "Usage: ./enginebench [clients] [seconds] [batch]" << endl;
+        return 1;
+    }
+
+    initCalcLib();
+    calcserver::Config cfg;
+    cfg.max_jobs = (uint32_t)nclients * 2;
+    calcserver::Engine engine;
+    if (!engine.init(cfg)) return 1;
+
+    vector<VClient> clients(nclients);
+    for (int i = 0; i < nclients; i++) {
+        sockaddr_in *s = (sockaddr_in*)&clients[i].addr;
+        memset(&clients[i].addr, 0, sizeof(clients[i].addr));
+        s->sin_family = AF_INET;
+        s->sin_addr.s_addr = htonl(0x0a000000u + (uint32_t)(i >> 14)); // 10.x.y.z
+        s->sin_port = htons(1024 + (i & 0x3fff));
+        clients[i].addrlen = sizeof(sockaddr_in);
+        make_hello(clients[i]);
+    }
+
+    vector<calcserver::Inbound> in(batch);
+    vector<calcserver::Outbound> out(batch);
+    vector<int> owner(batch);
+    uint64_t ok = 0, not_ok = 0, malformed = 0, datagrams = 0, batches = 0;
+
+    auto t0 = Clock::now();
+    auto deadline = t0 + chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds));
+    auto now = t0;
+    while (now < deadline) {
+        for (int first = 0; first < nclients; first += batch) {
+            int n = 0;
+            for (int i = first; i < nclients && n < batch; i++) {
+                if (clients[i].len == 0) continue;
+                in[n] = {clients[i].data, clients[i].len, &clients[i].addr, clients[i].addrlen};
+                owner[n++] = i;
+            }
+            if (n == 0) continue;
+            size_t k = engine.process(in.data(), n, out.data(), now);
+            datagrams += n;
+            for (int j = 0; j < n; j++) clients[owner[j]].len = 0;
+            for (size_t j = 0; j < k; j++) {
+                VClient &c = clients[owner[out[j].index]];
+                if (out[j].len == sizeof(calcProtocol)) {
+                    if (!make_answer(c, out[j].data)) malformed++;
+                    continue;
+                }
+                calcMessage verdict;
+                memcpy(&verdict, out[j].data, sizeof(verdict));
+                if (ntohl(verdict.message) == 1) ok++;
+                else not_ok++;
+                make_hello(c);
+            }
+            // A client whose datagram went unanswered starts over.
+            for (int j = 0; j < n; j++) {
+                if (clients[owner[j]].len == 0) make_hello(clients[owner[j]]);
+            }
+            if (++batches % 1000 == 0) {
+                now = Clock::now();
+                engine.advance(now);
+            }
+        }
+        now = Clock::now();
+    }
+
+    double elapsed = chrono::duration<double>(Clock::now() - t0).count();
+    const calcserver::Stats &st = engine.stats();
+    cout << "clients=" << nclients << " batch=" << batch << " seconds=" << elapsed << endl;
+    cout << "exchanges ok=" << ok << " not_ok=" << not_ok << " malformed=" << malformed << endl;
+    cout << "engine datagrams=" << st.datagrams << " hellos_admitted=" << st.hellos_admitted
+         << " results_served=" << st.results_served << " jobs_expired=" << st.jobs_expired
+         << " jobs_evicted=" << st.jobs_evicted << endl;
+    cout << "throughput=" << datagrams / elapsed << " datagrams/s, " << ok / elapsed << " exchanges/s, "
+         << elapsed * 1e9 / datagrams << " ns/datagram" << endl;
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef __HOST_PORT
+#define __HOST_PORT
+
+/*
+   "host:port" / "[ipv6]:port" argument parsing shared by the command line
+   tools (client, loadgen, director, impair). Header only, C++.
+*/
+
+#include <string>
+
+// Split <input> into <host> and <port>; false if it has neither form.
+inline bool splitHostPort(const std::string &input, std::string &host, std::string &port) {
+    if (input.empty()) return false;
+
+    if (input[0] == '[') {
+        size_t pos = input.find(']');
+        if (pos == std::string::npos || pos + 1 >= input.size() || input[pos+1] != ':') {
+            return false;
+        }
+        host = input.substr(1, pos - 1);
+        port = input.substr(pos + 2);
+    } else {
+        size_t pos = input.rfind(':');
+        if (pos == std::string::npos) {
+            return false;
+        }
+        host = input.substr(0, pos);
+        port = input.substr(pos + 1);
+    }
+    return true;
+}
+
+#endif
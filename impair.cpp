@@ -0,0 +1,300 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <queue>
+#include <random>
+#include <csignal>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "hostPort.h"
+
+/*
+   UDP network-impairment proxy for loopback experiments.
+
+   Clients send to <listen>; each client gets its own upstream socket
+   connected to <server>, so the server still sees one address per client.
+   Every datagram, in both directions, is independently lost, duplicated,
+   delayed and/or reordered:
+
+     --loss P      drop with probability P (0..1)
+     --dup P       deliver twice with probability P
+     --reorder P   hold back an extra --reorder-gap ms with probability P,
+                   so later datagrams overtake it
+     --delay MS    fixed one-way delay
+     --jitter MS   uniform extra delay in [0, MS]
+     --seed N      PRNG seed; the same seed and the same arrival order give
+                   the same decisions
+
+   Usage: ./impair <listen IP:PORT> <server IP:PORT> [options]
+   Counters are printed on SIGUSR1 and at exit.
+ */
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static const int CLIENT_IDLE_SECONDS = 60;
+
+struct Impairment {
+    double loss = 0.0, dup = 0.0, reorder = 0.0;
+    double delay_ms = 0.0, jitter_ms = 0.0, reorder_gap_ms = 5.0;
+    uint64_t seed = 1;
+};
+
+struct Client {
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    int up;                        // connected to the server
+    Clock::time_point last_seen;
+};
+
+struct Delayed {
+    Clock::time_point due;
+    uint64_t seq;                  // keeps equal due times in arrival order
+    int fd;
+    sockaddr_storage to;           // unused when <fd> is connected
+    socklen_t tolen;
+    vector<unsigned char> data;
+    bool operator>(const Delayed &o) const { return due != o.due ? due > o.due : seq > o.seq; }
+};
+
+struct Counters {
+    uint64_t in, lost, duplicated, reordered, delivered;
+};
+
+static volatile sig_atomic_t stop_proxy = 0;
+static volatile sig_atomic_t dump_requested = 0;
+static void handle_sig(int) { stop_proxy = 1; }
+static void handle_usr1(int) { dump_requested = 1; }
+
+static bool resolve(const string &hostport, sockaddr_storage &ss, socklen_t &len) {
+    string host, port;
+    if (!splitHostPort(hostport, host, port)) return false;
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return false;
+    memcpy(&ss, res->ai_addr, res->ai_addrlen);
+    len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static string addr_key(const sockaddr_storage &ss, socklen_t len) {
+    return string((const char*)&ss, len);
+}
+
+static void dump(const Counters &up, const Counters &down, size_t clients) {
+    cout << "client->server in=" << up.in << " lost=" << up.lost << " dup=" << up.duplicated
+         << " reordered=" << up.reordered << " delivered=" << up.delivered << endl;
+    cout << "server->client in=" << down.in << " lost=" << down.lost << " dup=" << down.duplicated
+         << " reordered=" << down.reordered << " delivered=" << down.delivered << endl;
+    cout << "clients=" << clients << endl;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        cout << "Usage: ./impair <listen IP:PORT> <server IP:PORT> [--loss P] [--dup P] [--reorder P]"
+             << " [--reorder-gap MS] [--delay MS] [--jitter MS] [--seed N]" << endl;
+        return 1;
+    }
+
+    Impairment imp;
+    for (int i = 3; i < argc; i++) {
+        if (i + 1 >= argc) {
+            cerr << "Missing value for " << argv[i] << endl;
+            return 1;
+        }
+        string opt = argv[i];
+        const char *arg = argv[++i];
+        char *end = nullptr;
+        if (opt == "--seed") {
+            errno = 0;
+            unsigned long long n = strtoull(arg, &end, 10);
+            if (*arg == '\0' || *arg == '-' || *end != '\0' || errno == ERANGE) {
+                cerr << "Invalid --seed: " << arg << endl;
+                return 1;
+            }
+            imp.seed = n;
+            continue;
+        }
+        // Probabilities lie in [0, 1], times in [0, 1 hour] (ms).
+        double v = strtod(arg, &end);
+        bool is_prob = opt == "--loss" || opt == "--dup" || opt == "--reorder";
+        double *dst = opt == "--loss" ? &imp.loss
+                    : opt == "--dup" ? &imp.dup
+                    : opt == "--reorder" ? &imp.reorder
+                    : opt == "--reorder-gap" ? &imp.reorder_gap_ms
+                    : opt == "--delay" ? &imp.delay_ms
+                    : opt == "--jitter" ? &imp.jitter_ms
+                    : nullptr;
+        if (!dst) {
+            cerr << "Unknown option " << opt << endl;
+            return 1;
+        }
+        if (*arg == '\0' || *end != '\0' || !(v >= 0 && v <= (is_prob ? 1.0 : 3600000.0))) {
+            cerr << "Invalid " << opt << (is_prob ? " (probability 0..1): " : " (ms): ") << arg << endl;
+            return 1;
+        }
+        *dst = v;
+    }
+
+    sockaddr_storage listen_addr, server_addr;
+    socklen_t listen_len, server_len;
+    if (!resolve(argv[1], listen_addr, listen_len) || !resolve(argv[2], server_addr, server_len)) {
+        cerr << "Could not resolve addresses" << endl;
+        return 1;
+    }
+    int front = socket(listen_addr.ss_family, SOCK_DGRAM, 0);
+    if (front < 0 || bind(front, (sockaddr*)&listen_addr, listen_len) < 0) {
+        perror("bind");
+        return 1;
+    }
+    fcntl(front, F_SETFL, fcntl(front, F_GETFL, 0) | O_NONBLOCK);
+
+    signal(SIGINT, handle_sig);
+    signal(SIGTERM, handle_sig);
+    signal(SIGUSR1, handle_usr1);
+
+    cout << "Impairing " << argv[1] << " -> " << argv[2] << ": loss=" << imp.loss << " dup=" << imp.dup
+         << " reorder=" << imp.reorder << " delay=" << imp.delay_ms << "ms jitter=" << imp.jitter_ms
+         << "ms seed=" << imp.seed << endl;
+
+    mt19937_64 rng(imp.seed);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    priority_queue<Delayed, vector<Delayed>, greater<Delayed>> pending;
+    map<string, Client> clients;
+    map<int, string> by_fd;        // upstream fd -> client key
+    Counters up = {0, 0, 0, 0, 0}, down = {0, 0, 0, 0, 0};
+    uint64_t seq = 0;
+
+    // Decide the fate of one datagram and schedule its copies.
+    auto impair = [&](Counters &c, int fd, const sockaddr_storage *to, socklen_t tolen,
+                      const unsigned char *data, size_t n, Clock::time_point now) {
+        c.in++;
+        if (unit(rng) < imp.loss) {
+            c.lost++;
+            return;
+        }
+        int copies = unit(rng) < imp.dup ? 2 : 1;
+        if (copies == 2) c.duplicated++;
+        for (int k = 0; k < copies; k++) {
+            double ms = imp.delay_ms + imp.jitter_ms * unit(rng);
+            if (unit(rng) < imp.reorder) {
+                ms += imp.reorder_gap_ms;
+                c.reordered++;
+            }
+            Delayed d;
+            d.due = now + chrono::microseconds((int64_t)(ms * 1000.0));
+            d.seq = seq++;
+            d.fd = fd;
+            if (to) d.to = *to;
+            d.tolen = to ? tolen : 0;
+            d.data.assign(data, data + n);
+            pending.push(move(d));
+        }
+    };
+
+    unsigned char buf[65536];
+    vector<pollfd> pfds;
+    auto last_sweep = Clock::now();
+
+    while (!stop_proxy) {
+        pfds.clear();
+        pfds.push_back({front, POLLIN, 0});
+        for (auto &kv : clients) pfds.push_back({kv.second.up, POLLIN, 0});
+
+        auto now = Clock::now();
+        int timeout = 100;
+        if (!pending.empty()) {
+            auto wait = chrono::duration_cast<chrono::milliseconds>(pending.top().due - now).count();
+            timeout = wait < 0 ? 0 : (wait < timeout ? (int)wait : timeout);
+        }
+        int pr = poll(pfds.data(), pfds.size(), timeout);
+        if (pr < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        now = Clock::now();
+
+        if (pr > 0 && (pfds[0].revents & POLLIN)) {
+            for (;;) {
+                sockaddr_storage from;
+                socklen_t fromlen = sizeof(from);
+                ssize_t n = recvfrom(front, buf, sizeof(buf), 0, (sockaddr*)&from, &fromlen);
+                if (n < 0) break;
+                string key = addr_key(from, fromlen);
+                auto it = clients.find(key);
+                if (it == clients.end()) {
+                    int s = socket(server_addr.ss_family, SOCK_DGRAM, 0);
+                    if (s < 0 || connect(s, (sockaddr*)&server_addr, server_len) < 0) {
+                        perror("upstream socket");
+                        if (s >= 0) close(s);
+                        continue;
+                    }
+                    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+                    Client c;
+                    c.addr = from;
+                    c.addrlen = fromlen;
+                    c.up = s;
+                    it = clients.emplace(key, c).first;
+                    by_fd[s] = key;
+                }
+                it->second.last_seen = now;
+                impair(up, it->second.up, nullptr, 0, buf, n, now);
+            }
+        }
+        for (size_t i = 1; pr > 0 && i < pfds.size(); i++) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            Client &c = clients[by_fd[pfds[i].fd]];
+            for (;;) {
+                ssize_t n = recv(c.up, buf, sizeof(buf), 0);
+                if (n < 0) break;
+                impair(down, front, &c.addr, c.addrlen, buf, n, now);
+            }
+        }
+
+        while (!pending.empty() && pending.top().due <= now) {
+            const Delayed &d = pending.top();
+            ssize_t s = d.tolen ? sendto(d.fd, d.data.data(), d.data.size(), 0, (const sockaddr*)&d.to, d.tolen)
+                                : send(d.fd, d.data.data(), d.data.size(), 0);
+            if (s >= 0) (d.tolen ? down : up).delivered++;
+            pending.pop();
+        }
+
+        if (now - last_sweep >= chrono::seconds(1)) {
+            last_sweep = now;
+            for (auto it = clients.begin(); it != clients.end();) {
+                if (now - it->second.last_seen >= chrono::seconds(CLIENT_IDLE_SECONDS)) {
+                    by_fd.erase(it->second.up);
+                    close(it->second.up);
+                    it = clients.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        if (dump_requested) {
+            dump_requested = 0;
+            dump(up, down, clients.size());
+        }
+    }
+
+    dump(up, down, clients.size());
+    for (auto &kv : clients) close(kv.second.up);
+    close(front);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#ifndef __JOB_TABLE
+#define __JOB_TABLE
+
+/*
+   Fixed-capacity table of outstanding jobs for the server. Header only, C++.
+
+   All memory is allocated by init(); insert/find/erase never allocate. Jobs
+   live in a slot array and are found through an open-addressing (linear
+   probing) index keyed on the job id. Live jobs are also chained in creation
+   order, so the oldest job is always at hand for expiry. Free slots are
+   chained through the same links.
+*/
+
+#include <stdint.h>
+#include <vector>
+#include <chrono>
+#include <sys/socket.h>
+#include "calcOps.h"
+
+class Job {
+public:
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    uint32_t id;
+    uint32_t arith;
+    uint32_t peer;           // Inbound::peer of the hello, 0 = none
+    calcops::Value in1, in2; // operands, kept for the result journal
+    calcops::Value expected;
+    std::chrono::steady_clock::time_point ts;       // created
+    std::chrono::steady_clock::time_point deadline; // expires, see the server's job TTL
+    uint32_t prev, next; // creation-order chain (or free list), owned by JobTable
+
+    // Default constructor
+    Job() : addrlen(0), id(0), arith(0), peer(0), in1{0, 0.0}, in2{0, 0.0}, expected{0, 0.0}, prev(0), next(0) {}
+};
+
+class JobTable {
+public:
+    static const uint32_t NIL = 0xffffffffu;
+
+    JobTable() : mask(0), shift(32), count(0), free_head(NIL), head(NIL), tail(NIL) {}
+
+    // Size the table for <capacity> jobs; the index is kept at most half full.
+    void init(uint32_t capacity) {
+        uint32_t bits = index_bits(capacity);
+        slots.assign(capacity, Job());
+        index.assign(1u << bits, 0);
+        mask = (1u << bits) - 1;
+        shift = 32 - bits;
+        count = 0;
+        head = tail = NIL;
+        free_head = capacity ? 0 : NIL;
+        for (uint32_t i = 0; i < capacity; i++) slots[i].next = i + 1 < capacity ? i + 1 : NIL;
+    }
+
+    // Bytes init(<capacity>) allocates.
+    static uint64_t memory_for(uint32_t capacity) {
+        return (uint64_t)capacity * sizeof(Job) + ((uint64_t)1 << index_bits(capacity)) * sizeof(uint32_t);
+    }
+
+    // Largest capacity (at most 2^30) whose memory_for() fits in <bytes>.
+    static uint32_t capacity_for(uint64_t bytes) {
+        uint32_t lo = 0, hi = 1u << 30;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo + 1) / 2;
+            if (memory_for(mid) <= bytes) lo = mid;
+            else hi = mid - 1;
+        }
+        return lo;
+    }
+
+    uint32_t size() const { return count; }
+    uint32_t capacity() const { return (uint32_t)slots.size(); }
+    uint64_t memory() const { return memory_for(capacity()); }
+    bool full() const { return free_head == NIL; }
+
+    Job *find(uint32_t id) {
+        uint32_t pos;
+        return lookup(id, pos) ? &slots[index[pos] - 1] : nullptr;
+    }
+
+    // Returns a zeroed job with <id> set, appended as the newest; nullptr when
+    // the table is full. The caller must make sure <id> is not in use.
+    Job *insert(uint32_t id) {
+        if (free_head == NIL) return nullptr;
+        uint32_t s = free_head;
+        free_head = slots[s].next;
+
+        Job &j = slots[s];
+        j = Job();
+        j.id = id;
+        j.prev = tail;
+        j.next = NIL;
+        if (tail != NIL) slots[tail].next = s;
+        else head = s;
+        tail = s;
+
+        uint32_t pos = home(id);
+        while (index[pos] != 0) pos = (pos + 1) & mask;
+        index[pos] = s + 1;
+        count++;
+        return &j;
+    }
+
+    void erase(Job *job) {
+        uint32_t s = (uint32_t)(job - &slots[0]);
+        uint32_t pos;
+        if (!lookup(job->id, pos)) return;
+        remove_index(pos);
+
+        if (job->prev != NIL) slots[job->prev].next = job->next;
+        else head = job->next;
+        if (job->next != NIL) slots[job->next].prev = job->prev;
+        else tail = job->prev;
+
+        job->next = free_head;
+        free_head = s;
+        count--;
+    }
+
+    // Oldest live job, or nullptr when empty.
+    Job *oldest() { return head == NIL ? nullptr : &slots[head]; }
+
+private:
+    std::vector<Job> slots;
+    std::vector<uint32_t> index; // slot + 1, 0 = empty
+    uint32_t mask, shift, count;
+    uint32_t free_head, head, tail;
+
+    static uint32_t index_bits(uint32_t capacity) {
+        uint32_t bits = 1;
+        while ((1ull << bits) < (uint64_t)capacity * 2) bits++;
+        return bits;
+    }
+
+    // Fibonacci hashing, so ids that only differ in their high bits still spread.
+    uint32_t home(uint32_t id) const { return (uint32_t)(id * 2654435769u) >> shift & mask; }
+
+    bool lookup(uint32_t id, uint32_t &pos) const {
+        pos = home(id);
+        while (index[pos] != 0) {
+            if (slots[index[pos] - 1].id == id) return true;
+            pos = (pos + 1) & mask;
+        }
+        return false;
+    }
+
+    // Backward-shift deletion keeps probe chains intact without tombstones.
+    void remove_index(uint32_t hole) {
+        uint32_t j = hole;
+        for (;;) {
+            index[hole] = 0;
+            for (;;) {
+                j = (j + 1) & mask;
+                if (index[j] == 0) return;
+                uint32_t k = home(slots[index[j] - 1].id);
+                bool stays = hole <= j ? (hole < k && k <= j) : (hole < k || k <= j);
+                if (!stays) break;
+            }
+            index[hole] = index[j];
+            hole = j;
+        }
+    }
+};
+
+#endif
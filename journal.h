@@ -0,0 +1,74 @@
+#ifndef __JOURNAL
+#define __JOURNAL
+
+/*
+   On-disk format of the server's result journal (server --journal DIR), read
+   back by ./journalq.
+
+   A journal is a directory of segments named journal-NNNNNN.bin. Each segment
+   starts with a journalSegmentHeader followed by fixed-width journalRecords,
+   one per finished job. Segments are preallocated, so a record whose time_ns
+   is 0 marks the end of the written part. All fields are in host byte order;
+   the journal is meant to be read on the machine that wrote it.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define JOURNAL_MAGIC "CALCJRNL"
+#define JOURNAL_VERSION 1
+
+enum {
+  JOURNAL_OK = 1,       // result verified
+  JOURNAL_NOT_OK = 2,   // result wrong
+  JOURNAL_EXPIRED = 3,  // no result within the job's TTL
+  JOURNAL_EVICTED = 4   // dropped unanswered to make room in a full table
+};
+
+struct __attribute__((__packed__)) journalSegmentHeader {
+  char magic[8];          // JOURNAL_MAGIC, not NUL terminated
+  uint32_t version;       // JOURNAL_VERSION
+  uint32_t record_size;   // sizeof(journalRecord)
+  uint64_t segment;       // sequence number, matches the file name
+  uint64_t created_ns;    // CLOCK_REALTIME
+  uint8_t reserved[32];
+};
+
+struct __attribute__((__packed__)) journalRecord {
+  uint64_t time_ns;       // CLOCK_REALTIME when the job finished; 0 = end of segment
+  uint32_t id;            // job id
+  uint32_t latency_us;    // assignment sent -> result received (or expired/evicted)
+  uint8_t arith;          // calcops code
+  uint8_t verdict;        // JOURNAL_OK, JOURNAL_NOT_OK, JOURNAL_EXPIRED, JOURNAL_EVICTED
+  uint16_t family;        // client address family, 4 or 6
+  uint16_t port;          // client port, network order
+  uint8_t addr[16];       // client address, network order; IPv4 uses the first 4 bytes
+  uint16_t reserved;
+  int32_t in1, in2;       // integer operands
+  int32_t in_expected, in_submitted;
+  double fl1, fl2;        // float operands
+  double fl_expected, fl_submitted;
+};
+
+static_assert(sizeof(journalSegmentHeader) == 64, "journalSegmentHeader must stay 64 bytes");
+static_assert(sizeof(journalRecord) == 88, "journalRecord layout changed, bump JOURNAL_VERSION");
+
+/* Fill the client fields of <r> from <ss>. */
+inline void journal_encode_addr(journalRecord &r, const sockaddr_storage &ss) {
+  memset(r.addr, 0, sizeof(r.addr));
+  if (ss.ss_family == AF_INET) {
+    const sockaddr_in *s = (const sockaddr_in*)&ss;
+    r.family = 4;
+    r.port = s->sin_port;
+    memcpy(r.addr, &s->sin_addr, 4);
+  } else {
+    const sockaddr_in6 *s6 = (const sockaddr_in6*)&ss;
+    r.family = 6;
+    r.port = s6->sin6_port;
+    memcpy(r.addr, &s6->sin6_addr, 16);
+  }
+}
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef __JOURNAL_WRITER
+#define __JOURNAL_WRITER
+
+/*
+   Background writer for the result journal (journal.h). Header only, C++.
+
+   The server thread fills records in a preallocated single-producer /
+   single-consumer ring (reserve() + commit()), which never allocates or
+   blocks; when the ring is full the record is dropped and counted. A writer
+   thread drains the ring into the current segment with pwrite() and starts a
+   new segment, preallocated with posix_fallocate(), once the current one is
+   full. Numbering continues after the highest segment already in the
+   directory, so a restart never overwrites an old journal.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+class JournalWriter {
+public:
+    static constexpr int IDLE_SLEEP_MS = 5; // writer poll interval while the ring is empty
+
+    JournalWriter() : seg_bytes(0), next_seg(0), fd(-1), offset(0),
+                      head(0), tail(0), stopping(false), n_written(0), n_dropped(0) {}
+    ~JournalWriter() { close(); }
+
+    // Create the first segment in <dir> (made if missing) and start the
+    // writer thread.
+    bool open(const char *dir, uint64_t segment_bytes, uint32_t ring_capacity) {
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            perror(dir);
+            return false;
+        }
+        directory = dir;
+        path.assign(directory.size() + sizeof("/journal-18446744073709551615.bin"), '\0');
+        seg_bytes = segment_bytes;
+        ring.assign(ring_capacity, journalRecord());
+        next_seg = first_free_segment();
+        if (!rotate()) return false;
+        writer = std::thread(&JournalWriter::run, this);
+        return true;
+    }
+
+    // Drain what is queued, stop the writer and trim the last segment.
+    void close() {
+        if (!writer.joinable()) return;
+        stopping.store(true, std::memory_order_release);
+        writer.join();
+        if (fd >= 0) {
+            if (ftruncate(fd, offset) != 0) perror("journal ftruncate");
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // Producer side. Returns a slot to fill, or nullptr (counted as dropped)
+    // when the writer has fallen a full ring behind.
+    journalRecord *reserve() {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) >= ring.size()) {
+            n_dropped++;
+            return nullptr;
+        }
+        return &ring[t % ring.size()];
+    }
+
+    void commit() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    uint64_t written() const { return n_written.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return n_dropped; }
+    uint64_t queued() const { return tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed); }
+
+private:
+    std::string directory;
+    std::vector<char> path; // segment file name, sized by open() so rotate() never allocates
+    uint64_t seg_bytes, next_seg;
+    int fd;
+    uint64_t offset; // write position in the current segment
+
+    std::vector<journalRecord> ring;
+    std::atomic<uint64_t> head, tail; // consumer / producer positions
+    std::atomic<bool> stopping;
+    std::atomic<uint64_t> n_written;
+    uint64_t n_dropped; // producer only
+    std::thread writer;
+
+    static uint64_t now_ns() {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    uint64_t first_free_segment() {
+        uint64_t next = 0;
+        DIR *d = opendir(directory.c_str());
+        if (!d) return 0;
+        while (dirent *e = readdir(d)) {
+            unsigned long long n;
+            char extra;
+            if (sscanf(e->d_name, "journal-%llu.bi%c", &n, &extra) == 2 && n + 1 > next) next = n + 1;
+        }
+        closedir(d);
+        return next;
+    }
+
+    // Close the current segment and start the next one.
+    bool rotate() {
+        if (fd >= 0) ::close(fd);
+        snprintf(path.data(), path.size(), "%s/journal-%06llu.bin", directory.c_str(),
+                 (unsigned long long)next_seg);
+        fd = ::open(path.data(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            perror(path.data());
+            return false;
+        }
+        int rc = posix_fallocate(fd, 0, seg_bytes);
+        if (rc != 0) fprintf(stderr, "journal: posix_fallocate %s: %s\n", path.data(), strerror(rc));
+
+        journalSegmentHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+        h.version = JOURNAL_VERSION;
+        h.record_size = sizeof(journalRecord);
+        h.segment = next_seg++;
+        h.created_ns = now_ns();
+        if (pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+            perror(path.data());
+            return false;
+        }
+        offset = sizeof(h);
+        return true;
+    }
+
+    void run() {
+        const uint64_t cap = ring.size();
+        const uint64_t per_segment = (seg_bytes - sizeof(journalSegmentHeader)) / sizeof(journalRecord);
+        for (;;) {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            uint64_t avail = tail.load(std::memory_order_acquire) - h;
+            if (avail == 0) {
+                if (stopping.load(std::memory_order_acquire)) return;
+                std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_SLEEP_MS));
+                continue;
+            }
+            uint64_t room = per_segment - (offset - sizeof(journalSegmentHeader)) / sizeof(journalRecord);
+            if (room == 0) {
+                if (!rotate()) return;
+                continue;
+            }
+            // One contiguous run of the ring, limited by the room left in the segment.
+            uint64_t k = avail;
+            if (k > cap - h % cap) k = cap - h % cap;
+            if (k > room) k = room;
+            ssize_t w = pwrite(fd, &ring[h % cap], k * sizeof(journalRecord), offset);
+            if (w != (ssize_t)(k * sizeof(journalRecord))) {
+                perror("journal pwrite");
+                return;
+            }
+            offset += w;
+            n_written.fetch_add(k, std::memory_order_relaxed);
+            head.store(h + k, std::memory_order_release);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "calcOps.h"
+
+/*
+   Aggregates over a server result journal (server --journal DIR).
+
+   Every segment is mmap()ed and scanned once; nothing is parsed or copied,
+   so a scan runs at roughly memory (or page cache) bandwidth. Prints the
+   verdict totals, error rates per operator, the busiest clients and the
+   latency distribution of answered jobs. Percentiles come from a log-linear
+   histogram (32 sub-buckets per power of two), so they are exact below
+   64 us and within about 3% above.
+
+   Usage: ./journalq <DIR|segment>... [--top N]
+ */
+
+using namespace std;
+
+static const int HIST_EXACT = 64;
+static const int HIST_SUB_BITS = 5;
+static const int HIST_BUCKETS = HIST_EXACT + (32 - 6) * (1 << HIST_SUB_BITS);
+
+static int hist_bucket(uint32_t v) {
+    if (v < (uint32_t)HIST_EXACT) return v;
+    int e = 31 - __builtin_clz(v);
+    int sub = (v >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return HIST_EXACT + (e - 6) * (1 << HIST_SUB_BITS) + sub;
+}
+
+// Lower bound of bucket <b>.
+static uint64_t hist_value(int b) {
+    if (b < HIST_EXACT) return b;
+    int e = (b - HIST_EXACT) / (1 << HIST_SUB_BITS) + 6;
+    int sub = (b - HIST_EXACT) % (1 << HIST_SUB_BITS);
+    return (uint64_t)((1 << HIST_SUB_BITS) + sub) << (e - HIST_SUB_BITS);
+}
+
+struct ClientKey {
+    uint8_t addr[16];
+    uint16_t port;
+    uint16_t family;
+    bool operator==(const ClientKey &o) const { return memcmp(this, &o, sizeof(*this)) == 0; }
+};
+
+struct ClientKeyHash {
+    size_t operator()(const ClientKey &k) const {
+        const uint8_t *p = (const uint8_t*)&k;
+        uint64_t h = 1469598103934665603ull; // FNV-1a
+        for (size_t i = 0; i < sizeof(k); i++) h = (h ^ p[i]) * 1099511628211ull;
+        return h;
+    }
+};
+
+struct Counts {
+    uint64_t ok, not_ok, expired, evicted;
+    uint64_t total() const { return ok + not_ok + expired + evicted; }
+};
+
+struct Summary {
+    uint64_t segments = 0, records = 0, bad = 0;
+    uint64_t first_ns = 0, last_ns = 0;
+    Counts all = {0, 0, 0, 0};
+    Counts per_op[calcops::OP_COUNT + 1] = {};
+    unordered_map<ClientKey, Counts, ClientKeyHash> per_client;
+    vector<uint64_t> latency = vector<uint64_t>(HIST_BUCKETS, 0);
+    uint64_t answered = 0;
+};
+
+static void tally(Counts &c, uint8_t verdict) {
+    if (verdict == JOURNAL_OK) c.ok++;
+    else if (verdict == JOURNAL_NOT_OK) c.not_ok++;
+    else if (verdict == JOURNAL_EXPIRED) c.expired++;
+    else c.evicted++;
+}
+
+static bool scan_segment(const string &path, Summary &sum) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(journalSegmentHeader)) {
+        cerr << path << ": not a journal segment" << endl;
+        close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path.c_str());
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    const journalSegmentHeader *h = (const journalSegmentHeader*)map;
+    if (memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic)) != 0 || h->version != JOURNAL_VERSION
+        || h->record_size != sizeof(journalRecord)) {
+        cerr << path << ": bad header or unsupported version" << endl;
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    const journalRecord *r = (const journalRecord*)(h + 1);
+    size_t n = (st.st_size - sizeof(*h)) / sizeof(journalRecord);
+    for (size_t i = 0; i < n && r[i].time_ns != 0; i++) {
+        const journalRecord &rec = r[i];
+        if (rec.arith == 0 || rec.arith > calcops::OP_COUNT || rec.verdict < JOURNAL_OK || rec.verdict > JOURNAL_EVICTED) {
+            sum.bad++;
+            continue;
+        }
+        sum.records++;
+        if (sum.first_ns == 0 || rec.time_ns < sum.first_ns) sum.first_ns = rec.time_ns;
+        if (rec.time_ns > sum.last_ns) sum.last_ns = rec.time_ns;
+        tally(sum.all, rec.verdict);
+        tally(sum.per_op[rec.arith], rec.verdict);
+
+        ClientKey k;
+        memcpy(k.addr, rec.addr, sizeof(k.addr));
+        k.port = rec.port;
+        k.family = rec.family;
+        tally(sum.per_client[k], rec.verdict);
+
+        if (rec.verdict == JOURNAL_OK || rec.verdict == JOURNAL_NOT_OK) {
+            sum.latency[hist_bucket(rec.latency_us)]++;
+            sum.answered++;
+        }
+    }
+    sum.segments++;
+    munmap(map, st.st_size);
+    return true;
+}
+
+// Segment files in <dir>, in sequence order.
+static vector<string> list_segments(const string &dir) {
+    vector<string> names;
+    DIR *d = opendir(dir.c_str());
+    if (!d) return names;
+    while (dirent *e = readdir(d)) {
+        unsigned long long n;
+        char extra;
+        if (sscanf(e->d_name, "journal-%llu.bi%c", &n, &extra) == 2) names.push_back(e->d_name);
+    }
+    closedir(d);
+    sort(names.begin(), names.end());
+    for (auto &name : names) name = dir + "/" + name;
+    return names;
+}
+
+static string client_to_string(const ClientKey &k) {
+    char buf[INET6_ADDRSTRLEN];
+    inet_ntop(k.family == 6 ? AF_INET6 : AF_INET, k.addr, buf, sizeof(buf));
+    string s = k.family == 6 ? "[" + string(buf) + "]" : string(buf);
+    return s + ":" + to_string(ntohs(k.port));
+}
+
+static uint64_t percentile(const vector<uint64_t> &hist, uint64_t total, double p) {
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(p * (total - 1)), seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist[b];
+        if (seen > rank) return hist_value(b);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+static double error_rate(const Counts &c) {
+    return c.ok + c.not_ok ? (double)c.not_ok / (c.ok + c.not_ok) : 0.0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t top = 10;
+    vector<string> segments;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top = strtoul(argv[++i], nullptr, 10);
+            continue;
+        }
+        struct stat st;
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            vector<string> in_dir = list_segments(argv[i]);
+            segments.insert(segments.end(), in_dir.begin(), in_dir.end());
+        } else {
+            segments.push_back(argv[i]);
+        }
+    }
+    if (segments.empty()) {
+        cout << "Usage: ./journalq <DIR|segment>... [--top N]" << endl;
+        return 1;
+    }
+
+    Summary sum;
+    for (auto &path : segments) scan_segment(path, sum);
+
+    cout << fixed << setprecision(4);
+    cout << "segments=" << sum.segments << " records=" << sum.records;
+    if (sum.bad) cout << " malformed=" << sum.bad;
+    cout << " span_s=" << (sum.last_ns - sum.first_ns) / 1e9 << endl;
+    cout << "ok=" << sum.all.ok << " not_ok=" << sum.all.not_ok << " expired=" << sum.all.expired
+         << " evicted=" << sum.all.evicted << " error_rate=" << error_rate(sum.all) << endl;
+
+    cout << endl << "operator        total          ok      not_ok     expired     evicted  error_rate" << endl;
+    for (uint32_t code = 1; code <= calcops::OP_COUNT; code++) {
+        const Counts &c = sum.per_op[code];
+        cout << setw(8) << left << calcops::OPS[code].name << right
+             << setw(12) << c.total() << setw(12) << c.ok << setw(12) << c.not_ok
+             << setw(12) << c.expired << setw(12) << c.evicted << setw(12) << error_rate(c) << endl;
+    }
+
+    vector<pair<ClientKey, Counts>> clients(sum.per_client.begin(), sum.per_client.end());
+    size_t shown = min(top, clients.size());
+    partial_sort(clients.begin(), clients.begin() + shown, clients.end(),
+                 [](const pair<ClientKey, Counts> &a, const pair<ClientKey, Counts> &b) {
+                     return a.second.total() > b.second.total();
+                 });
+    cout << endl << "clients=" << clients.size() << ", top " << shown << " by jobs:" << endl;
+    for (size_t i = 0; i < shown; i++) {
+        const Counts &c = clients[i].second;
+        cout << "  " << setw(44) << left << client_to_string(clients[i].first) << right
+             << " total=" << c.total() << " ok=" << c.ok << " not_ok=" << c.not_ok
+             << " expired=" << c.expired << " evicted=" << c.evicted << endl;
+    }
+
+    cout << endl << "latency_us (answered=" << sum.answered << ")"
+         << " p50=" << percentile(sum.latency, sum.answered, 0.50)
+         << " p90=" << percentile(sum.latency, sum.answered, 0.90)
+         << " p99=" << percentile(sum.latency, sum.answered, 0.99)
+         << " p999=" << percentile(sum.latency, sum.answered, 0.999)
+         << " max=" << percentile(sum.latency, sum.answered, 1.0) << endl;
+    return 0;
+}
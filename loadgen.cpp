@@ -0,0 +1,257 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "protocol.h"
+#include "calcOps.h"
+#include "hostPort.h"
+
+/*
+   Closed-loop load generator. Runs <clients> virtual clients against the
+   server, each doing hello -> assignment -> result -> verdict over its own
+   socket, with the same 2 s x 3 retry policy as ./client. At the end it
+   prints throughput and the latency distribution of complete exchanges.
+
+   With [burst] > 1 each client pipelines that many exchanges: it sends its
+   hellos, and later its answers, back to back (as one UDP_SEGMENT send when
+   the kernel supports it), which exercises the server's GRO/GSO paths. A
+   burst that times out is counted as failed and restarted, not retried.
+
+   Usage: ./loadgen <host:port> [clients] [seconds] [burst]
+ */
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static const int RETRY_MS = 2000;
+static const int MAX_TRIES = 3;
+
+enum State { IDLE, WAIT_ASSIGN, WAIT_VERDICT };
+
+struct VClient {
+    int sock;
+    State state;
+    int tries;
+    int got;                    // assignments/verdicts received in this state
+    Clock::time_point started;  // start of the exchange
+    Clock::time_point sent_at;  // last (re)transmission
+    vector<calcProtocol> reply; // kept for retransmission, one per pipelined exchange
+};
+
+static int burst = 1;
+static bool use_gso = true;
+
+// Send <count> datagrams of <seg> bytes each, laid out back to back in <data>.
+static void send_segments(int sock, const void *data, size_t seg, int count) {
+    if (count > 1 && use_gso) {
+        char ctrl[CMSG_SPACE(sizeof(uint16_t))] = {0};
+        iovec iov = {(void*)data, seg * count};
+        msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = ctrl;
+        mh.msg_controllen = sizeof(ctrl);
+        cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t s = (uint16_t)seg;
+        memcpy(CMSG_DATA(cm), &s, sizeof(s));
+        if (sendmsg(sock, &mh, 0) >= 0) return;
+        use_gso = false;
+    }
+    for (int i = 0; i < count; i++) {
+        send(sock, (const char*)data + i * seg, seg, 0);
+    }
+}
+
+static void send_hello(VClient &c, int count) {
+    static vector<calcMessage> hellos;
+    calcMessage hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.type = htons(22);
+    hello.message = htonl(0);
+    hello.protocol = htons(17);
+    hello.major_version = htons(1);
+    hello.minor_version = htons(0);
+    hellos.assign(count, hello);
+    send_segments(c.sock, hellos.data(), sizeof(hello), count);
+    c.sent_at = Clock::now();
+}
+
+static void start_exchange(VClient &c) {
+    c.state = WAIT_ASSIGN;
+    c.tries = 1;
+    c.got = 0;
+    c.started = Clock::now();
+    send_hello(c, burst);
+}
+
+// Build the answer to an assignment; returns false if it is malformed.
+static bool answer(const calcProtocol &in, calcProtocol &out) {
+    if (ntohs(in.type) != 1 || ntohs(in.major_version) != 1 || ntohs(in.minor_version) != 0) {
+        return false;
+    }
+    memset(&out, 0, sizeof(out));
+    out.type = htons(2);
+    out.major_version = htons(1);
+    out.minor_version = htons(0);
+    out.id = in.id;
+    out.arith = in.arith;
+    out.inValue1 = in.inValue1;
+    out.inValue2 = in.inValue2;
+    out.flValue1 = in.flValue1;
+    out.flValue2 = in.flValue2;
+
+    const calcops::OpInfo *op = calcops::lookup(ntohl(in.arith));
+    if (!op) return false;
+    calcops::Value v = calcops::eval(*op, (int32_t)ntohl(in.inValue1), (int32_t)ntohl(in.inValue2),
+                                     in.flValue1, in.flValue2);
+    out.inResult = htonl(v.i);
+    out.flResult = v.f;
+    return true;
+}
+
+static double percentile(const vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[idx];
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 5) {
+        cout << "Usage: ./loadgen <host:port> [clients] [seconds] [burst]" << endl;
+        return 1;
+    }
+
+    string host, port;
+    if (!splitHostPort(argv[1], host, port)) {
+        cout << "Invalid host:port format" << endl;
+        return 1;
+    }
+    int nclients = argc > 2 ? atoi(argv[2]) : 1;
+    int seconds = argc > 3 ? atoi(argv[3]) : 10;
+    burst = argc > 4 ? atoi(argv[4]) : 1;
+    if (nclients <= 0 || seconds <= 0 || burst <= 0 || burst > 64) {
+        cout << "clients and seconds must be positive, burst 1..64" << endl;
+        return 1;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        cout << "Could not resolve host" << endl;
+        return 1;
+    }
+
+    vector<VClient> clients(nclients);
+    vector<pollfd> pfds(nclients);
+    for (int i = 0; i < nclients; i++) {
+        int s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (s < 0 || connect(s, res->ai_addr, res->ai_addrlen) < 0) {
+            perror("socket/connect");
+            freeaddrinfo(res);
+            return 1;
+        }
+        clients[i].sock = s;
+        clients[i].state = IDLE;
+        clients[i].reply.resize(burst);
+        pfds[i].fd = s;
+        pfds[i].events = POLLIN;
+    }
+    freeaddrinfo(res);
+
+    vector<double> latencies_us;
+    latencies_us.reserve(1 << 20);
+    long ok = 0, not_ok = 0, failed = 0, retransmits = 0;
+
+    auto t0 = Clock::now();
+    auto deadline = t0 + chrono::seconds(seconds);
+    for (auto &c : clients) start_exchange(c);
+
+    unsigned char buf[2048];
+    while (Clock::now() < deadline) {
+        int pr = poll(pfds.data(), pfds.size(), 10);
+        if (pr < 0) {
+            perror("poll");
+            break;
+        }
+        auto now = Clock::now();
+
+        for (int i = 0; i < nclients; i++) {
+            VClient &c = clients[i];
+            if (pfds[i].revents & POLLIN) {
+                ssize_t n = recv(c.sock, buf, sizeof(buf), 0);
+                if (c.state == WAIT_ASSIGN && n == (ssize_t)sizeof(calcProtocol)) {
+                    calcProtocol in;
+                    memcpy(&in, buf, sizeof(in));
+                    if (!answer(in, c.reply[c.got])) {
+                        failed += burst;
+                        start_exchange(c);
+                    } else if (++c.got == burst) {
+                        c.state = WAIT_VERDICT;
+                        c.tries = 1;
+                        c.got = 0;
+                        send_segments(c.sock, c.reply.data(), sizeof(calcProtocol), burst);
+                        c.sent_at = now;
+                    }
+                } else if (c.state == WAIT_VERDICT && n == (ssize_t)sizeof(calcMessage)) {
+                    calcMessage verdict;
+                    memcpy(&verdict, buf, sizeof(verdict));
+                    if (ntohl(verdict.message) == 1) ok++;
+                    else not_ok++;
+                    latencies_us.push_back(chrono::duration<double, micro>(now - c.started).count());
+                    if (++c.got == burst) start_exchange(c);
+                }
+                continue;
+            }
+
+            if (c.state != IDLE && now - c.sent_at >= chrono::milliseconds(RETRY_MS)) {
+                if (c.tries >= MAX_TRIES || burst > 1) {
+                    failed += burst - c.got;
+                    start_exchange(c);
+                } else {
+                    c.tries++;
+                    retransmits++;
+                    if (c.state == WAIT_ASSIGN) send_hello(c, 1);
+                    else {
+                        send(c.sock, &c.reply[0], sizeof(calcProtocol), 0);
+                        c.sent_at = now;
+                    }
+                }
+            }
+        }
+    }
+
+    double elapsed = chrono::duration<double>(Clock::now() - t0).count();
+    sort(latencies_us.begin(), latencies_us.end());
+
+    cout << "clients=" << nclients << " seconds=" << elapsed << endl;
+    cout << "exchanges ok=" << ok << " not_ok=" << not_ok << " failed=" << failed
+         << " retransmits=" << retransmits << endl;
+    cout << "throughput=" << (ok + not_ok) / elapsed << " exchanges/s"
+         << " goodput=" << ok / elapsed << " ok/s" << endl;
+    cout << "latency_us p50=" << percentile(latencies_us, 0.50)
+         << " p90=" << percentile(latencies_us, 0.90)
+         << " p99=" << percentile(latencies_us, 0.99)
+         << " max=" << (latencies_us.empty() ? 0.0 : latencies_us.back()) << endl;
+
+    for (auto &c : clients) close(c.sock);
+    return 0;
+}
@@ -7,6 +7,7 @@
 
 
 #include "protocol.h"
+#include "calcOps.h"
 
 
 /* 
@@ -41,40 +42,23 @@ int main(int argc, char *argv[]){
   printf("string = %s, \n", ptr );
   */
 
-  /* Act differently depending on what operator you got, judge type by first char in string. If 'f' then a float */
+  /* Look the operator up in the registry (calcOps.h); it tells us if it is a float op and how to compute it. */
+  const calcops::OpInfo *op=calcops::lookup_name(ptr);
   
-  if(ptr[0]=='f'){
+  if(op->is_float){
     printf("Float\t");
     f1=randomFloat();
     f2=randomFloat();
 
     /* At this point, ptr holds operator, f1 and f2 the operands. Now we work to determine the reference result. */
-   
-    if(strcmp(ptr,"fadd")==0){
-      fresult=f1+f2;
-    } else if (strcmp(ptr, "fsub")==0){
-      fresult=f1-f2;
-    } else if (strcmp(ptr, "fmul")==0){
-      fresult=f1*f2;
-    } else if (strcmp(ptr, "fdiv")==0){
-      fresult=f1/f2;
-    }
+    fresult=op->feval(f1,f2);
     printf("%s %8.8g %8.8g = %8.8g\n",ptr,f1,f2,fresult);
   } else {
     printf("Int\t");
     i1=randomInt();
     i2=randomInt();
 
-    if(strcmp(ptr,"add")==0){
-      iresult=i1+i2;
-    } else if (strcmp(ptr, "sub")==0){
-      iresult=i1-i2;
-    } else if (strcmp(ptr, "mul")==0){
-      iresult=i1*i2;
-    } else if (strcmp(ptr, "div")==0){
-      iresult=i1/i2;
-    }
-
+    iresult=op->ieval(i1,i2);
     printf("%s %d %d = %d \n",ptr,i1,i2,iresult);
   }
 
@@ -98,36 +82,18 @@ int main(int argc, char *argv[]){
 
   printf("Command: |%s|\n",command);
   
-  if(command[0]=='f'){
+  op=calcops::lookup_name(command);
+  if(op==NULL){
+    printf("No match\n");
+  } else if(op->is_float){
     printf("Float\t");
     rv=sscanf(lineBuffer,"%s %lg %lg",command,&f1,&f2);
-    if(strcmp(command,"fadd")==0){
-      fresult=f1+f2;
-    } else if (strcmp(command, "fsub")==0){
-      fresult=f1-f2;
-    } else if (strcmp(command, "fmul")==0){
-      fresult=f1*f2;
-    } else if (strcmp(command, "fdiv")==0){
-      fresult=f1/f2;
-    }
+    fresult=op->feval(f1,f2);
     printf("%s %8.8g %8.8g = %8.8g\n",command,f1,f2,fresult);
   } else {
     printf("Int\t");
     rv=sscanf(lineBuffer,"%s %d %d",command,&i1,&i2);
-    if(strcmp(command,"add")==0){
-      iresult=i1+i2;
-    } else if (strcmp(command, "sub")==0){
-      iresult=i1-i2;
-      printf("[%s %d %d = %d ]\n",command,i1,i2,iresult);
-    } else if (strcmp(command, "mul")==0){
-      iresult=i1*i2;
-    } else if (strcmp(command, "div")==0){
-      
-      iresult=i1/i2;
-    } else {
-      printf("No match\n");
-    }
-
+    iresult=op->ieval(i1,i2);
     printf("%s %d %d = %d \n",command,i1,i2,iresult);
   }
   
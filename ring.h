@@ -0,0 +1,51 @@
+#ifndef __RING
+#define __RING
+
+/*
+   Fixed-capacity FIFO ring. Header only, C++. Storage is allocated once by
+   init(); push/pop never allocate, so it is safe on the server's steady-state
+   path.
+*/
+
+#include <stdint.h>
+#include <vector>
+
+template <typename T>
+class Ring {
+public:
+    Ring() : head(0), count(0) {}
+
+    void init(uint32_t capacity) {
+        items.assign(capacity, T());
+        head = count = 0;
+    }
+
+    uint32_t size() const { return count; }
+    uint32_t capacity() const { return (uint32_t)items.size(); }
+    bool empty() const { return count == 0; }
+    bool full() const { return count == items.size(); }
+
+    // Slot for a new element at the back; nullptr when full.
+    T *push() {
+        if (full()) return nullptr;
+        T *slot = &items[(head + count) % items.size()];
+        count++;
+        return slot;
+    }
+
+    T &front() { return items[head]; }
+
+    // i-th element from the front, i < size().
+    T &at(uint32_t i) { return items[(head + i) % items.size()]; }
+
+    void pop() {
+        head = (head + 1) % items.size();
+        count--;
+    }
+
+private:
+    std::vector<T> items;
+    uint32_t head, count;
+};
+
+#endif
@@ -4,119 +4,1225 @@
 #include <ctime>
 #include <cmath>
 #include <chrono>
-#include <unordered_map>
-#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <csignal>
+#include <cerrno>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <netinet/udp.h>
 #include "protocol.h"
 #include "calcLib.h"
+#include "calcServer.h"
+#include "ring.h"
+#include "directorProtocol.h"
+#include "journalWriter.h"
+#include "stageTrace.h"
+#ifdef ALLOC_CHECK
+#include "allocCheck.h"
+#endif
 
 using namespace std;
 using Clock = chrono::steady_clock;
 
-class Job {
-public:
+// The protocol engine (calcServer.h); everything in this file is the UDP
+// transport around it.
+static calcserver::Engine engine;
+static mutex engine_mtx; // only contended in busy-poll mode, where housekeeping runs on its own thread
+static int srv_sock = -1;
+static atomic<bool> stop_server(false);
+
+static auto last_activity_time = Clock::now();
+static const int IDLE_TIMEOUT_SECONDS = 60; // Timeout period in seconds
+static const uint32_t DEFAULT_MAX_JOBS = 65536;
+static const int BUSY_POLL_USEC = 50;       // SO_BUSY_POLL budget per receive call
+
+// Defaults for --ttl-min/--ttl-max; see calcServer.h for how the job TTL
+// adapts between them. The table is sized by --max-jobs or --job-memory.
+// The floor covers the clients' retry window: a result resent at +2 s and
+// +4 s (3 tries, 2 s apart) must still find its job.
+static const double DEFAULT_TTL_MIN_S = 6.0;
+static const double DEFAULT_TTL_MAX_S = 10.0;
+
+// Batched I/O. With UDP_GRO one received buffer can hold up to 64 coalesced
+// datagrams of equal size; with UDP_SEGMENT same-destination, same-size
+// replies leave as one super-datagram that the kernel splits.
+static const int RECV_BATCH = 32;
+static const size_t RECV_BUF_SZ = 65536;
+static const int MAX_GSO_SEGMENTS = 64;
+static const size_t MAX_GSO_BYTES = 65000;
+static const size_t REPLY_MAX = 128;
+static const int MAX_REPLIES = RECV_BATCH * MAX_GSO_SEGMENTS;
+
+struct Reply {
     sockaddr_storage addr;
     socklen_t addrlen;
-    uint32_t id;
-    bool is_float;
-    int32_t i_expected;
-    double f_expected;
-    Clock::time_point ts;
+    int16_t peer;   // connected peer socket to send on, -1 = srv_sock
+    uint16_t len;
+    unsigned char data[REPLY_MAX];
+};
 
-    // Default constructor
-    Job() : addrlen(0), id(0), is_float(false), i_expected(0), f_expected(0.0) {}
+static Reply replies[MAX_REPLIES];
+static int n_replies = 0;
+static bool use_gso = false;
+static bool use_gro = false;
 
-    // Parameterized constructor
-    Job(sockaddr_storage a, socklen_t l, uint32_t tid, bool f, int32_t ei, double ed)
-        : addr(a), addrlen(l), id(tid), is_float(f), i_expected(ei), f_expected(ed) {
-        ts = Clock::now();
-    }
+// The socket is non-blocking. Replies the kernel will not take right now
+// (EAGAIN) wait in send_backlog, a preallocated ring that is drained when the
+// socket is writable again (EPOLLOUT), so receiving never waits on sending.
+// While the backlog is non-empty new replies join its tail to keep order.
+// When it is full the configured policy drops a reply and counts it.
+static const uint32_t DEFAULT_SEND_QUEUE = 4096;
+static const int BACKLOG_BATCH = 256; // replies per sendmmsg() when draining
+
+enum DropPolicy { DROP_NEWEST, DROP_OLDEST };
+static DropPolicy send_drop_policy = DROP_NEWEST;
+static Ring<Reply> send_backlog;
+
+// Where a datagram came from. In --director mode <via> is the director that
+// relayed it and <addr> the client named in its directorHeader; otherwise
+// vialen is 0 and replies go straight to <addr>. <peer> is the connected
+// peer socket it arrived on, valid while peers[peer].token == peer_token.
+struct Origin {
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    sockaddr_storage via;
+    socklen_t vialen;
+    int16_t peer;          // -1 = srv_sock
+    uint32_t peer_token;
 };
 
-static unordered_map<uint32_t, Job> jobs;
-static int srv_sock = -1;
-static bool stop_server = false;
+// --director: all traffic is framed (directorProtocol.h). SIGTERM starts a
+// drain instead of stopping: probes report DIR_FLAG_DRAINING so the director
+// stops sending hellos, and the server exits once its jobs are answered or
+// have expired. Hellos the director relays before it has seen the flag are
+// still served, so the server only counts as drained after it has sent the
+// flag in a probe reply and then seen no hello for DIR_PROBE_MS. A second
+// SIGTERM stops it at once.
+static bool director_mode = false;
+static volatile sig_atomic_t draining = 0;
+static bool drain_flag_sent = false;     // a probe reply carried DIR_FLAG_DRAINING
+static Clock::time_point drain_flag_at;  // ... first at this time
+static Clock::time_point last_relayed_hello;
 
-static auto last_activity_time = Clock::now();
-static const int IDLE_TIMEOUT_SECONDS = 60; // Timeout period in seconds
+// Overload mode (--overload). Results for existing jobs are handled as soon
+// as they are drained from the socket; hellos wait in a bounded queue and are
+// only admitted while the job table is below its high-water mark. Hellos that
+// find the queue full, or wait longer than a client would before retrying,
+// are shed (dropped without reply).
+static const int OVERLOAD_DRAIN_BATCHES = 8;         // recvmmsg calls per cycle
+static const uint32_t OVERLOAD_ADMIT_PER_CYCLE = 256; // hellos admitted per cycle
+static const double OVERLOAD_HIGH_WATER = 0.9;        // fraction of --max-jobs
+static const int OVERLOAD_MAX_WAIT_MS = 1000;         // client retries after 2 s
+static const uint32_t DEFAULT_OVERLOAD_QUEUE = 1024;
+
+struct PendingHello {
+    Origin from;
+    Clock::time_point arrived;
+    unsigned char data[sizeof(calcMessage)];
+};
+
+static bool overload_mode = false;
+static Ring<PendingHello> hello_queue;
+static uint64_t hellos_queued = 0;    // pushed into hello_queue so far
+static uint64_t hellos_dequeued = 0;  // popped from hello_queue so far
+static uint64_t deferred_mark = 0;    // queue positions below this were counted as deferred
+
+// --journal DIR: every finished job (verified, wrong or expired) is appended
+// as a journalRecord. Records go through JournalWriter's preallocated ring, so
+// the hot path stays allocation-free; if the writer falls behind they are
+// dropped and counted rather than stalling the server.
+static const uint64_t DEFAULT_JOURNAL_SEGMENT_MB = 64;
+static const uint32_t JOURNAL_RING = 65536; // records
+
+static JournalWriter journal;
+static bool journaling = false;
+
+// Connected peers (--connected-peers N, 0 = off). A source that sends at
+// least --peer-rate datagrams/s to srv_sock gets a socket of its own, bound
+// to the same address with SO_REUSEPORT and connect()ed to it. The kernel
+// then demultiplexes that flow for us (a connected socket wins the lookup
+// for its peer and is never picked for anyone else; what it caught between
+// bind() and connect() is told apart by source address), replies leave without
+// an address or per-datagram route lookup, and the engine matches the
+// peer's results to its jobs by token instead of comparing addresses.
+// Heavy sources are found with a small table of per-window counters, where
+// a colliding source wears the resident's count down before taking the
+// slot. A peer below 1/8 of the rate for PEER_IDLE_WINDOWS windows in a row
+// is demoted: its socket is drained, closed, and it is back on srv_sock.
+static const uint32_t DEFAULT_CONNECTED_PEERS = 16;
+static const uint32_t MAX_CONNECTED_PEERS = 256;
+static const uint32_t DEFAULT_PEER_RATE = 1000; // datagrams/s
+static const int PEER_WINDOW_MS = 1000;
+static const int PEER_IDLE_WINDOWS = 3;
+static const uint32_t SENDER_SLOTS = 1024;      // power of two
+
+struct Peer {
+    int fd;                 // -1 = free slot
+    uint32_t token;         // Inbound::peer, never reused; 0 while free
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    char addr_str[calcserver::ADDR_STR_LEN];
+    uint64_t window_datagrams;
+    int idle_windows;
+    bool ready;             // epoll reported it readable
+};
+
+struct SenderCount {
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    uint32_t count;         // datagrams this window, net of collisions
+};
+
+static Peer peers[MAX_CONNECTED_PEERS];
+static uint32_t peer_slots = 0;        // slots ever used, the scan bound
+static uint32_t n_peers = 0;
+static uint32_t max_peers = DEFAULT_CONNECTED_PEERS;
+static uint32_t peer_rate = DEFAULT_PEER_RATE;
+static uint32_t next_peer_token = 1;
+static SenderCount senders[SENDER_SLOTS];
+static Clock::time_point peer_window_start;
+static sockaddr_storage srv_addr;      // what srv_sock is bound to
+static socklen_t srv_addrlen = 0;
+static int epoll_fd = -1;              // peers are added to it when set
+static bool poll_all_peers = false;    // busy-poll mode: try every peer each cycle
+
+// Transport counters; the engine keeps its own (calcserver::Stats).
+struct ServerStats {
+    uint64_t hellos_deferred;   // hellos that had to wait at least one cycle
+    uint64_t hellos_shed_full;  // dropped on arrival, queue full
+    uint64_t hellos_shed_stale; // dropped after waiting OVERLOAD_MAX_WAIT_MS
+    uint64_t send_backlogged;   // replies that had to wait in send_backlog
+    uint64_t send_dropped;      // replies dropped by the send drop policy
+    uint64_t send_errors;       // replies lost to other send errors
+    uint32_t send_backlog_max;  // high-water mark of send_backlog
+    uint64_t peers_promoted;    // connected peer sockets opened
+    uint64_t peers_demoted;     // ... and closed again for being idle
+    uint64_t peer_datagrams;    // received on connected peer sockets
+    uint64_t peer_strays;       // ... from another source, queued before connect()
+};
+static ServerStats stats;
+static volatile sig_atomic_t dump_requested = 0;
+
+#ifdef ALLOC_CHECK
+// serverA: once ALLOC_WARMUP datagrams have been handled, any heap allocation
+// inside a STEADY_STATE scope is a bug. Abort so the check run fails loudly.
+static const uint64_t ALLOC_WARMUP = 1000;
+
+struct AllocGuard {
+    const char *what;
+    uint64_t before;
+    explicit AllocGuard(const char *w) : what(w), before(alloc_count()) {}
+    ~AllocGuard() {
+        uint64_t n = alloc_count() - before;
+        if (engine.stats().datagrams >= ALLOC_WARMUP && n != 0) {
+            fprintf(stderr, "ALLOC CHECK FAILED: %s made %llu heap allocation(s)\n",
+                    what, (unsigned long long)n);
+            abort();
+        }
+    }
+};
+#define STEADY_STATE(what) AllocGuard alloc_guard_(what)
+#else
+#define STEADY_STATE(what) do {} while(0)
+#endif
 
 static void handle_sig(int) {
-    stop_server = true;
+    if (director_mode && !draining) draining = 1;
+    else stop_server = true;
+}
+
+static void handle_usr1(int) {
+    dump_requested = 1;
+}
+
+static void dump_stats() {
+    const calcserver::Stats &es = engine.stats();
+    cout << "stats: datagrams=" << es.datagrams
+         << " jobs=" << engine.size() << "/" << engine.capacity()
+         << " job_memory_kb=" << engine.memory() / 1024
+         << " ttl_ms=" << engine.ttl().count()
+         << " answered_frac=" << engine.answered_fraction()
+         << " answer_p99_ms=" << engine.answer_p99()
+         << " results_served=" << es.results_served
+         << " hellos_admitted=" << es.hellos_admitted
+         << " jobs_expired=" << es.jobs_expired
+         << " jobs_evicted=" << es.jobs_evicted
+         << " hellos_deferred=" << stats.hellos_deferred
+         << " hellos_shed_full=" << stats.hellos_shed_full
+         << " hellos_shed_stale=" << stats.hellos_shed_stale
+         << " hello_queue=" << hello_queue.size()
+         << " send_backlogged=" << stats.send_backlogged
+         << " send_dropped=" << stats.send_dropped
+         << " send_errors=" << stats.send_errors
+         << " send_backlog=" << send_backlog.size() << "/" << send_backlog.capacity()
+         << " send_backlog_max=" << stats.send_backlog_max
+         << " peers=" << n_peers << "/" << max_peers
+         << " peers_promoted=" << stats.peers_promoted
+         << " peers_demoted=" << stats.peers_demoted
+         << " peer_datagrams=" << stats.peer_datagrams
+         << " peer_strays=" << stats.peer_strays;
+    if (journaling) {
+        cout << " journal_written=" << journal.written()
+             << " journal_dropped=" << journal.dropped()
+             << " journal_queued=" << journal.queued();
+    }
+    cout << endl;
+#ifdef STAGE_TRACE
+    stage_tracer.dump(cout);
+#endif
+}
+
+static void maybe_dump_stats() {
+    if (dump_requested) {
+        dump_requested = 0;
+        dump_stats();
+    }
+}
+
+using calcserver::ADDR_STR_LEN;
+using calcserver::addr_to_string;
+using calcserver::same_sockaddr;
+
+void check_idle_timeout() {
+    auto now = Clock::now();
+    auto diff = chrono::duration_cast<chrono::seconds>(now - last_activity_time).count();
+    if (diff >= IDLE_TIMEOUT_SECONDS) {
+        cout << "Server has been idle for too long. Shutting down." << endl;
+        stop_server = true;
+    }
+}
+
+static void check_drain() {
+    static bool announced = false;
+    static Clock::time_point started;
+    if (!draining) return;
+    auto now = Clock::now();
+    if (!announced) {
+        announced = true;
+        started = now;
+        cout << "Draining: " << engine.size() << " jobs outstanding." << endl;
+    }
+    const auto probe = chrono::milliseconds(DIR_PROBE_MS);
+    bool director_knows = drain_flag_sent && now - drain_flag_at >= probe && now - last_relayed_hello >= probe;
+    if ((engine.size() == 0 && director_knows) || now - started >= engine.max_ttl()) {
+        cout << "Drained, shutting down." << endl;
+        stop_server = true;
+    }
+}
+
+// Expire jobs and adapt the job TTL.
+static void advance_engine() {
+    STEADY_STATE("advance_engine");
+    engine.advance(Clock::now());
+}
+
+// Pin the calling thread to a single CPU.
+static bool pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Keep the calling thread off <cpu>, unless that would leave it nowhere to run.
+static void avoid_cpu(int cpu) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return;
+    CPU_CLR(cpu, &set);
+    if (CPU_COUNT(&set) > 0) sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void flush_replies();
+
+// Relayed replies go back to the director, framed with the client's address.
+// Either way the destination is where the datagram came from, so a reply
+// leaves on the connected peer socket it arrived on while that is still open.
+static void queue_reply(const Origin &to, const void *data, size_t len) {
+    if (n_replies == MAX_REPLIES) flush_replies();
+    Reply &r = replies[n_replies++];
+    r.peer = to.peer >= 0 && peers[to.peer].token == to.peer_token ? to.peer : -1;
+    if (to.vialen == 0) {
+        r.addr = to.addr;
+        r.addrlen = to.addrlen;
+        r.len = (uint16_t)len;
+        memcpy(r.data, data, len);
+        return;
+    }
+    directorHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = htons(DIRECTOR_MAGIC);
+    h.kind = DIR_RELAY;
+    dir_encode_addr(h, to.addr);
+    r.addr = to.via;
+    r.addrlen = to.vialen;
+    r.len = (uint16_t)(sizeof(h) + len);
+    memcpy(r.data, &h, sizeof(h));
+    memcpy(r.data + sizeof(h), data, len);
+}
+
+static void backlog_push(const Reply &r) {
+    if (send_backlog.full()) {
+        stats.send_dropped++;
+        if (send_drop_policy == DROP_NEWEST) return;
+        send_backlog.pop();
+    }
+    *send_backlog.push() = r;
+    stats.send_backlogged++;
+    if (send_backlog.size() > stats.send_backlog_max) stats.send_backlog_max = send_backlog.size();
+}
+
+// Send from the front of send_backlog, one datagram per reply, until it is
+// empty or the socket buffer is full again. Backlogged replies always go out
+// on srv_sock, addressed, whichever socket they were meant for; the peer
+// sees the same source either way.
+static void drain_backlog() {
+    static mmsghdr msgs[BACKLOG_BATCH];
+    static iovec iovs[BACKLOG_BATCH];
+
+    while (!send_backlog.empty()) {
+        int k = send_backlog.size() < (uint32_t)BACKLOG_BATCH ? send_backlog.size() : BACKLOG_BATCH;
+        for (int i = 0; i < k; i++) {
+            Reply &r = send_backlog.at(i);
+            iovs[i].iov_base = r.data;
+            iovs[i].iov_len = r.len;
+            msghdr &mh = msgs[i].msg_hdr;
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_name = &r.addr;
+            mh.msg_namelen = r.addrlen;
+            mh.msg_iov = &iovs[i];
+            mh.msg_iovlen = 1;
+        }
+        int sent = sendmmsg(srv_sock, msgs, k, 0);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            perror("sendmmsg backlog");
+            stats.send_errors++;
+            sent = 1; // give up on the reply at the front
+        }
+        for (int i = 0; i < sent; i++) send_backlog.pop();
+    }
 }
 
-static string addr_to_string(const sockaddr_storage &ss) {
-    char host[INET6_ADDRSTRLEN] = {0};
-    char port[8] = {0};
+// Send everything queued by queue_reply(). Replies are grouped by socket,
+// destination and size (keeping their order within a group); with GSO each
+// group of two or more goes out as one UDP_SEGMENT send. The groups are
+// ordered by socket, srv_sock first, and each socket's run of groups is
+// handed to the kernel with one sendmmsg(); on a connected peer socket
+// without a destination address. Whatever the kernel does not take goes to
+// send_backlog.
+static void flush_replies() {
+    static int group_first[MAX_REPLIES], group_last[MAX_REPLIES], group_count[MAX_REPLIES];
+    static int next_in_group[MAX_REPLIES], group_of[MAX_REPLIES], order[MAX_REPLIES];
+    static bool group_unsent[MAX_REPLIES];
+    static uint32_t by_socket[MAX_CONNECTED_PEERS + 2];
+    static unsigned char staging[MAX_REPLIES * REPLY_MAX];
+    static mmsghdr msgs[MAX_REPLIES];
+    static iovec iovs[MAX_REPLIES];
+    static union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        cmsghdr align;
+    } ctrl[MAX_REPLIES];
+
+    if (!send_backlog.empty()) drain_backlog();
+    if (!send_backlog.empty()) {
+        for (int i = 0; i < n_replies; i++) backlog_push(replies[i]);
+        n_replies = 0;
+        return;
+    }
+
+    int ngroups = 0;
+    for (int i = 0; i < n_replies; i++) {
+        next_in_group[i] = -1;
+        int g = -1;
+        if (use_gso) {
+            for (int k = ngroups - 1; k >= 0; k--) {
+                const Reply &head = replies[group_first[k]];
+                // One connected socket has one destination.
+                if (head.len == replies[i].len && head.peer == replies[i].peer &&
+                    (head.peer >= 0 || same_sockaddr(head.addr, replies[i].addr)) &&
+                    group_count[k] < MAX_GSO_SEGMENTS &&
+                    (size_t)(group_count[k] + 1) * head.len <= MAX_GSO_BYTES) {
+                    g = k;
+                    break;
+                }
+            }
+        }
+        if (g < 0) {
+            g = ngroups++;
+            group_first[g] = i;
+            group_count[g] = 0;
+        } else {
+            next_in_group[group_last[g]] = i;
+        }
+        group_last[g] = i;
+        group_count[g]++;
+        group_of[i] = g;
+    }
+
+    // Counting sort of the groups by socket: key 0 is srv_sock, key p + 1
+    // connected peer p.
+    memset(by_socket, 0, (peer_slots + 2) * sizeof(by_socket[0]));
+    for (int g = 0; g < ngroups; g++) by_socket[replies[group_first[g]].peer + 2]++;
+    for (uint32_t k = 1; k < peer_slots + 2; k++) by_socket[k] += by_socket[k - 1];
+    for (int g = 0; g < ngroups; g++) order[by_socket[replies[group_first[g]].peer + 1]++] = g;
+
+    size_t staged = 0;
+    for (int m = 0; m < ngroups; m++) {
+        int g = order[m];
+        Reply &head = replies[group_first[g]];
+        group_unsent[g] = false;
+        msghdr &mh = msgs[m].msg_hdr;
+        memset(&mh, 0, sizeof(mh));
+        if (head.peer < 0) {
+            mh.msg_name = &head.addr;
+            mh.msg_namelen = head.addrlen;
+        }
+        mh.msg_iov = &iovs[m];
+        mh.msg_iovlen = 1;
+
+        if (group_count[g] == 1) {
+            iovs[m].iov_base = head.data;
+            iovs[m].iov_len = head.len;
+            continue;
+        }
+
+        unsigned char *dst = staging + staged;
+        size_t len = 0;
+        for (int i = group_first[g]; i >= 0; i = next_in_group[i]) {
+            memcpy(dst + len, replies[i].data, replies[i].len);
+            len += replies[i].len;
+        }
+        staged += len;
+        iovs[m].iov_base = dst;
+        iovs[m].iov_len = len;
+
+        mh.msg_control = ctrl[m].buf;
+        mh.msg_controllen = sizeof(ctrl[m].buf);
+        cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t seg = head.len;
+        memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+    }
+
+    int off = 0;
+    while (off < ngroups) {
+        int peer = replies[group_first[order[off]]].peer;
+        int end = off + 1;
+        while (end < ngroups && replies[group_first[order[end]]].peer == peer) end++;
+        int fd = peer < 0 ? srv_sock : peers[peer].fd;
+
+        while (off < end) {
+            int r = sendmmsg(fd, msgs + off, end - off, 0);
+            if (r > 0) {
+                off += r;
+                continue;
+            }
+            if (r < 0 && errno == EINTR) continue;
+            if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+
+            // msgs[off] failed. A segmented send failing with EIO/EINVAL means
+            // the route or device cannot do GSO after all: stop using it and
+            // let the backlog send that group one datagram at a time.
+            int g = order[off];
+            if (msgs[off].msg_hdr.msg_control && (errno == EIO || errno == EINVAL)) {
+                cerr << "UDP GSO send failed, falling back to one datagram per reply" << endl;
+                use_gso = false;
+                group_unsent[g] = true;
+            } else {
+                perror("sendmmsg reply");
+                stats.send_errors += group_count[g];
+            }
+            off++;
+        }
+        for (; off < end; off++) group_unsent[order[off]] = true;
+    }
+
+    for (int i = 0; i < n_replies; i++) {
+        if (group_unsent[group_of[i]]) backlog_push(replies[i]);
+    }
+    n_replies = 0;
+}
+
+// Hand one protocol datagram to the engine and queue its reply, if any. A
+// connected peer vouches for the client address only when it is the client
+// itself, not a director relaying for others.
+static void handle_datagram(const unsigned char *buf, size_t n, const Origin &from, Clock::time_point now) {
+    calcserver::Inbound in = {buf, n, &from.addr, from.addrlen, 0, nullptr};
+    if (from.vialen == 0 && from.peer >= 0) {
+        in.peer = from.peer_token;
+        if (peers[from.peer].token == from.peer_token) in.addr_str = peers[from.peer].addr_str;
+    }
+    calcserver::Outbound out;
+    if (!engine.handle(in, out, now)) return;
+    queue_reply(from, out.data, out.len);
+    TRACE_MARK(STAGE_ENCODE);
+}
+
+// Probe the kernel for UDP GSO/GRO on srv_sock; either may be absent.
+static void negotiate_offloads(bool want_gso, bool want_gro) {
+    if (want_gso) {
+        int seg = 0;
+        socklen_t sl = sizeof(seg);
+        use_gso = getsockopt(srv_sock, SOL_UDP, UDP_SEGMENT, &seg, &sl) == 0;
+    }
+    if (want_gro) {
+        int on = 1;
+        use_gro = setsockopt(srv_sock, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+    }
+    cout << "UDP GSO " << (use_gso ? "on" : "off") << ", UDP GRO " << (use_gro ? "on" : "off") << endl;
+}
+
+static void answer_probe(const Origin &from) {
+    directorHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = htons(DIRECTOR_MAGIC);
+    h.kind = DIR_PROBE_REPLY;
+    h.flags = draining ? DIR_FLAG_DRAINING : 0;
+    h.load = htonl(engine.size());
+    queue_reply(from, &h, sizeof(h));
+    if (draining && !drain_flag_sent) {
+        drain_flag_sent = true;
+        drain_flag_at = Clock::now();
+    }
+}
+
+// Unwrap director framing if configured; in overload mode hellos are queued
+// instead of handled on arrival.
+static void dispatch_datagram(const unsigned char *buf, size_t n,
+                              const sockaddr_storage &src, socklen_t src_len,
+                              const Peer *peer, Clock::time_point now) {
+    Origin from;
+    from.addr = src;
+    from.addrlen = src_len;
+    from.vialen = 0;
+    from.peer = peer ? (int16_t)(peer - peers) : -1;
+    from.peer_token = peer ? peer->token : 0;
+
+    if (director_mode) {
+        directorHeader h;
+        if (n >= sizeof(h)) memcpy(&h, buf, sizeof(h));
+        if (n < sizeof(h) || ntohs(h.magic) != DIRECTOR_MAGIC ||
+            (h.kind != DIR_PROBE && h.kind != DIR_RELAY)) {
+            char src_str[ADDR_STR_LEN];
+            cout << "ERROR WRONG SIZE OR INCORRECT PROTOCOL from " << addr_to_string(src, src_str) << endl;
+            return;
+        }
+        if (h.kind == DIR_PROBE) {
+            answer_probe(from);
+            return;
+        }
+        from.via = src;
+        from.vialen = src_len;
+        if (!dir_decode_addr(h, from.addr, from.addrlen)) return;
+        buf += sizeof(h);
+        n -= sizeof(h);
+        if (n == sizeof(calcMessage)) last_relayed_hello = now;
+    }
+
+    if (!overload_mode || n != sizeof(calcMessage)) {
+        handle_datagram(buf, n, from, now);
+        return;
+    }
+    PendingHello *p = hello_queue.push();
+    if (p == nullptr) {
+        stats.hellos_shed_full++;
+        return;
+    }
+    hellos_queued++;
+    p->from = from;
+    p->arrived = now;
+    memcpy(p->data, buf, n);
+}
+
+// Admit queued hellos oldest first, within the per-cycle budget and while the
+// job table is below the high-water mark; shed the ones that waited too long.
+static void serve_hello_queue(Clock::time_point now) {
+    uint32_t high_water = (uint32_t)(engine.capacity() * OVERLOAD_HIGH_WATER);
+    uint32_t admitted = 0;
+    while (!hello_queue.empty()) {
+        PendingHello &p = hello_queue.front();
+        if (now - p.arrived >= chrono::milliseconds(OVERLOAD_MAX_WAIT_MS)) {
+            stats.hellos_shed_stale++;
+        } else if (admitted < OVERLOAD_ADMIT_PER_CYCLE && engine.size() < high_water) {
+            handle_datagram(p.data, sizeof(p.data), p.from, now);
+            TRACE_COMMIT();
+            admitted++;
+        } else {
+            break;
+        }
+        hello_queue.pop();
+        hellos_dequeued++;
+    }
+
+    // Whatever is still queued has now been deferred at least once.
+    uint64_t first_new = deferred_mark > hellos_dequeued ? deferred_mark : hellos_dequeued;
+    stats.hellos_deferred += hellos_queued - first_new;
+    deferred_mark = hellos_queued;
+}
+
+// Count <n> datagrams from <ss> towards promoting it to a connected peer.
+static void note_sender(const sockaddr_storage &ss, socklen_t len, uint32_t n) {
+    const unsigned char *p;
+    size_t plen;
+    uint16_t port;
     if (ss.ss_family == AF_INET) {
         const sockaddr_in *s = (const sockaddr_in*)&ss;
-        inet_ntop(AF_INET, &s->sin_addr, host, sizeof(host));
-        snprintf(port, sizeof(port), "%u", ntohs(s->sin_port));
+        p = (const unsigned char*)&s->sin_addr;
+        plen = 4;
+        port = s->sin_port;
     } else {
         const sockaddr_in6 *s6 = (const sockaddr_in6*)&ss;
-        inet_ntop(AF_INET6, &s6->sin6_addr, host, sizeof(host));
-        snprintf(port, sizeof(port), "%u", ntohs(s6->sin6_port));
+        p = (const unsigned char*)&s6->sin6_addr;
+        plen = 16;
+        port = s6->sin6_port;
+    }
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < plen; i++) h = (h ^ p[i]) * 16777619u;
+    h = (h ^ port) * 16777619u;
+
+    SenderCount &c = senders[h & (SENDER_SLOTS - 1)];
+    if (c.count == 0) {
+        c.addr = ss;
+        c.addrlen = len;
+        c.count = n;
+    } else if (same_sockaddr(c.addr, ss)) {
+        c.count += n;
+    } else {
+        c.count = c.count > n ? c.count - n : 0;
     }
-    return string(host) + ":" + string(port);
 }
 
-static bool same_sockaddr(const sockaddr_storage &a, const sockaddr_storage &b) {
-    if (a.ss_family != b.ss_family) return false;
-    if (a.ss_family == AF_INET) {
-        const sockaddr_in *pa = (const sockaddr_in*)&a;
-        const sockaddr_in *pb = (const sockaddr_in*)&b;
-        return pa->sin_port == pb->sin_port && pa->sin_addr.s_addr == pb->sin_addr.s_addr;
+// Receive up to RECV_BATCH buffers from srv_sock, or from <peer>'s connected
+// socket, without blocking; split GRO buffers into protocol units and
+// dispatch each. Returns the number of buffers received, 0 if none were
+// pending, -1 on error.
+static int receive_batch(Peer *peer) {
+    static unsigned char bufs[RECV_BATCH][RECV_BUF_SZ];
+    static sockaddr_storage addrs[RECV_BATCH];
+    static mmsghdr msgs[RECV_BATCH];
+    static iovec iovs[RECV_BATCH];
+    static union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        cmsghdr align;
+    } ctrl[RECV_BATCH];
+
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = use_gro ? RECV_BUF_SZ : 2048;
+        msghdr &mh = msgs[i].msg_hdr;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_name = &addrs[i];
+        mh.msg_namelen = sizeof(addrs[i]);
+        mh.msg_iov = &iovs[i];
+        mh.msg_iovlen = 1;
+        if (use_gro) {
+            mh.msg_control = ctrl[i].buf;
+            mh.msg_controllen = sizeof(ctrl[i].buf);
+        }
+    }
+
+    int r = recvmmsg(peer ? peer->fd : srv_sock, msgs, RECV_BATCH, MSG_DONTWAIT, nullptr);
+    if (r > 0) {
+        TRACE_MARK(STAGE_RECV);
+        TRACE_COMMIT();
     } else {
-        const sockaddr_in6 *pa = (const sockaddr_in6*)&a;
-        const sockaddr_in6 *pb = (const sockaddr_in6*)&b;
-        return pa->sin6_port == pb->sin6_port &&
-               memcmp(&pa->sin6_addr, &pb->sin6_addr, sizeof(in6_addr)) == 0;
+        TRACE_START(); // an empty poll is not pipeline time
+    }
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        // A connected socket reports ICMP errors from its peer; not fatal.
+        if (peer) return 0;
+        perror("recvmmsg");
+        return -1;
     }
+    auto now = Clock::now();
+    if (r > 0) last_activity_time = now;
+
+    for (int i = 0; i < r; i++) {
+        size_t len = msgs[i].msg_len;
+        size_t seg = len;
+        msghdr &mh = msgs[i].msg_hdr;
+        if (use_gro) {
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+                if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                    int gso_size;
+                    memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+                    if (gso_size > 0) seg = (size_t)gso_size;
+                }
+            }
+        }
+        const sockaddr_storage &src = addrs[i];
+        socklen_t src_len = mh.msg_namelen;
+        uint32_t units = len == 0 ? 1 : (uint32_t)((len + seg - 1) / seg);
+        // Between bind() and connect() a peer socket is an ordinary member of
+        // the reuseport group, so it can hold datagrams from anyone. Those
+        // keep their real source and get no peer token.
+        Peer *from = peer && same_sockaddr(src, peer->addr) ? peer : nullptr;
+        if (peer && !from) stats.peer_strays += units;
+        if (from) {
+            from->window_datagrams += units;
+            stats.peer_datagrams += units;
+        } else if (max_peers) {
+            note_sender(src, src_len, units);
+        }
+        if (len == 0) {
+            dispatch_datagram(bufs[i], 0, src, src_len, from, now);
+            TRACE_COMMIT();
+            continue;
+        }
+        for (size_t off = 0; off < len; off += seg) {
+            size_t n = len - off < seg ? len - off : seg;
+            dispatch_datagram(bufs[i] + off, n, src, src_len, from, now);
+            TRACE_COMMIT();
+        }
+    }
+    return r;
+}
+
+// Give <addr> a socket of its own: bound to srv_sock's address with
+// SO_REUSEPORT, connected to the peer, and watched by epoll if there is one.
+static void promote_peer(const sockaddr_storage &addr, socklen_t addrlen) {
+    uint32_t slot = 0;
+    while (slot < MAX_CONNECTED_PEERS && peers[slot].fd >= 0) slot++;
+    if (slot == MAX_CONNECTED_PEERS) return;
+
+    int fd = socket(srv_addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("socket (connected peer)");
+        return;
+    }
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+#ifdef SO_REUSEPORT
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+#endif
+    if (bind(fd, (const sockaddr*)&srv_addr, srv_addrlen) < 0 ||
+        connect(fd, (const sockaddr*)&addr, addrlen) < 0) {
+        perror("bind/connect (connected peer)");
+        close(fd);
+        return;
+    }
+    if (use_gro) setsockopt(fd, SOL_UDP, UDP_GRO, &yes, sizeof(yes));
+    if (epoll_fd >= 0) {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = slot + 1;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl (connected peer)");
+            close(fd);
+            return;
+        }
+    }
+
+    Peer &p = peers[slot];
+    p.fd = fd;
+    p.token = next_peer_token++;
+    if (next_peer_token == 0) next_peer_token = 1;
+    p.addr = addr;
+    p.addrlen = addrlen;
+    addr_to_string(addr, p.addr_str);
+    p.window_datagrams = 0;
+    p.idle_windows = 0;
+    p.ready = false;
+    if (slot + 1 > peer_slots) peer_slots = slot + 1;
+    n_peers++;
+    stats.peers_promoted++;
+    cout << "Peer " << p.addr_str << " promoted to a connected socket." << endl;
 }
 
-static uint32_t new_id() {
-    uint32_t id;
-    do {
-        id = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
-    } while (id == 0 || jobs.find(id) != jobs.end());
-    return id;
+// Hand <p> back to srv_sock. Whatever is already queued on its socket is
+// handled first; a datagram landing between that and close() is lost like
+// any other, and the client retries.
+static void demote_peer(Peer &p) {
+    receive_batch(&p);
+    flush_replies();
+    close(p.fd); // also leaves the epoll set
+    p.fd = -1;
+    p.token = 0;
+    n_peers--;
+    stats.peers_demoted++;
+    cout << "Peer " << p.addr_str << " demoted to the shared socket." << endl;
 }
 
-static int arith_code_from_name(const string &op) {
-    if (op == "add") return 1;
-    if (op == "sub") return 2;
-    if (op == "mul") return 3;
-    if (op == "div") return 4;
-    if (op == "fadd") return 5;
-    if (op == "fsub") return 6;
-    if (op == "fmul") return 7;
-    if (op == "fdiv") return 8;
-    return 0;
+static bool is_peer(const sockaddr_storage &addr) {
+    for (uint32_t i = 0; i < peer_slots; i++) {
+        if (peers[i].fd >= 0 && same_sockaddr(peers[i].addr, addr)) return true;
+    }
+    return false;
 }
 
-void check_idle_timeout() {
+// Once per PEER_WINDOW_MS: demote peers that went quiet, promote the
+// sources that sent at least --peer-rate datagrams/s, start a new window.
+static void update_peers() {
+    STEADY_STATE("update_peers");
+    if (max_peers == 0) return;
     auto now = Clock::now();
-    auto diff = chrono::duration_cast<chrono::seconds>(now - last_activity_time).count();
-    if (diff >= IDLE_TIMEOUT_SECONDS) {
-        cout << "Server has been idle for too long. Shutting down." << endl;
-        stop_server = true;
+    double secs = chrono::duration<double>(now - peer_window_start).count();
+    if (secs * 1000 < PEER_WINDOW_MS) return;
+    peer_window_start = now;
+    double heavy = peer_rate * secs;
+
+    for (uint32_t i = 0; i < peer_slots; i++) {
+        Peer &p = peers[i];
+        if (p.fd < 0) continue;
+        if (p.window_datagrams * 8 < heavy) p.idle_windows++;
+        else p.idle_windows = 0;
+        p.window_datagrams = 0;
+        if (p.idle_windows >= PEER_IDLE_WINDOWS) demote_peer(p);
+    }
+    for (uint32_t i = 0; i < SENDER_SLOTS && n_peers < max_peers; i++) {
+        const SenderCount &c = senders[i];
+        if (c.count >= heavy && !is_peer(c.addr)) promote_peer(c.addr, c.addrlen);
+    }
+    for (uint32_t i = 0; i < SENDER_SLOTS; i++) senders[i].count = 0;
+}
+
+static void close_peers() {
+    for (uint32_t i = 0; i < peer_slots; i++) {
+        if (peers[i].fd >= 0) close(peers[i].fd);
+        peers[i].fd = -1;
+        peers[i].token = 0;
     }
+    n_peers = 0;
+}
+
+// One service cycle: send what is backlogged, then receive, handle and flush.
+// Connected peers are read after srv_sock, those epoll found readable or, in
+// busy-poll mode, all of them. In overload mode srv_sock is drained harder
+// first, so results queued behind a burst of hellos are answered before any
+// new job is created.
+static int service_socket() {
+    STEADY_STATE("service_socket");
+    TRACE_START();
+    if (!send_backlog.empty()) {
+        drain_backlog();
+        TRACE_MARK(STAGE_SEND);
+        TRACE_COMMIT();
+    }
+    int r = receive_batch(nullptr);
+    for (uint32_t i = 0; i < peer_slots; i++) {
+        Peer &p = peers[i];
+        if (p.fd < 0 || !(p.ready || poll_all_peers)) continue;
+        p.ready = false;
+        receive_batch(&p);
+    }
+    if (overload_mode) {
+        for (int i = 1; i < OVERLOAD_DRAIN_BATCHES && r == RECV_BATCH; i++) {
+            r = receive_batch(nullptr);
+        }
+        serve_hello_queue(Clock::now());
+    }
+    bool replying = n_replies > 0;
+    flush_replies();
+    if (replying) {
+        TRACE_MARK(STAGE_SEND);
+        TRACE_COMMIT();
+    }
+    return r;
+}
+
+// Default mode: sleep in epoll_wait() and do housekeeping between wakeups.
+// EPOLLOUT is only armed while replies are backlogged; the backlog drains
+// through srv_sock. Event data is 0 for srv_sock and slot + 1 for a peer.
+static void run_epoll_loop() {
+    int ep = epoll_create1(0);
+    if (ep < 0) {
+        perror("epoll_create1");
+        return;
+    }
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = 0;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, srv_sock, &ev) < 0) {
+        perror("epoll_ctl");
+        close(ep);
+        return;
+    }
+    epoll_fd = ep;
+    bool want_out = false;
+
+    while (!stop_server) {
+        // Check for idle timeout
+        check_idle_timeout();
+        check_drain();
+        if (stop_server) break;
+
+        advance_engine();
+        update_peers();
+        maybe_dump_stats();
+
+        if (want_out != !send_backlog.empty()) {
+            want_out = !want_out;
+            ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+            epoll_ctl(ep, EPOLL_CTL_MOD, srv_sock, &ev);
+        }
+
+        // wait; don't sleep while deferred hellos wait for admission
+        static epoll_event got[1 + MAX_CONNECTED_PEERS];
+        int timeout_ms = hello_queue.empty() ? 200 : 1; // 200ms
+        int nev = epoll_wait(ep, got, 1 + MAX_CONNECTED_PEERS, timeout_ms);
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        if (nev == 0) {
+            if (!hello_queue.empty()) service_socket();
+            continue; // loop to cleanup
+        }
+
+        // readable and/or writable
+        for (int i = 0; i < nev; i++) {
+            if (got[i].data.u32 > 0) peers[got[i].data.u32 - 1].ready = true;
+        }
+        service_socket();
+    }
+    epoll_fd = -1;
+    close(ep);
+}
+
+// Busy-poll mode: the receive loop owns <cpu> and never sleeps; idle checks,
+// job expiry and peer promotion run on a housekeeping thread kept off that
+// core. The spinner holds engine_mtx for one service cycle at a time and
+// would win nearly every race for it, so the housekeeper raises
+// housekeeping_wanted first and the spinner stands back until it has had
+// its turn. Connected peers are polled every cycle.
+static atomic<bool> housekeeping_wanted(false);
+
+static void run_busy_poll_loop(int cpu) {
+    poll_all_peers = true;
+#ifdef SO_BUSY_POLL
+    int usec = BUSY_POLL_USEC;
+    if (setsockopt(srv_sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+        perror("setsockopt SO_BUSY_POLL (continuing without)");
+    }
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+    int prefer = 1;
+    if (setsockopt(srv_sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) < 0) {
+        perror("setsockopt SO_PREFER_BUSY_POLL (continuing without)");
+    }
+#endif
+
+    thread housekeeper([] {
+        while (!stop_server) {
+            this_thread::sleep_for(chrono::milliseconds(200));
+            housekeeping_wanted.store(true, memory_order_release);
+            lock_guard<mutex> lk(engine_mtx);
+            housekeeping_wanted.store(false, memory_order_release);
+            check_idle_timeout();
+            check_drain();
+            advance_engine();
+            update_peers();
+            maybe_dump_stats();
+        }
+    });
+
+    if (!pin_to_cpu(cpu)) {
+        perror("sched_setaffinity (continuing unpinned)");
+    }
+    cout << "Busy-poll receive loop pinned to CPU " << cpu << endl;
+
+    while (!stop_server) {
+        if (housekeeping_wanted.load(memory_order_acquire)) {
+            this_thread::yield();
+            continue;
+        }
+        lock_guard<mutex> lk(engine_mtx);
+        service_socket();
+    }
+
+    housekeeper.join();
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        cerr << "Usage: " << argv[0] << " <IP:PORT>" << endl;
+    int busy_cpu = -1;
+    bool want_gso = true, want_gro = true;
+    calcserver::Config cfg;
+    uint32_t max_jobs = DEFAULT_MAX_JOBS;
+    bool max_jobs_set = false;
+    uint64_t job_memory_mb = 0;
+    double ttl_min_s = DEFAULT_TTL_MIN_S, ttl_max_s = DEFAULT_TTL_MAX_S;
+    uint32_t overload_queue = DEFAULT_OVERLOAD_QUEUE;
+    uint32_t send_queue = DEFAULT_SEND_QUEUE;
+    const char *journal_dir = nullptr;
+    uint64_t journal_segment_mb = DEFAULT_JOURNAL_SEGMENT_MB;
+    bool usage = argc < 2;
+    for (int i = 2; i < argc && !usage; i++) {
+        if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            long cpu = strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || cpu < 0 || cpu >= CPU_SETSIZE) {
+                cerr << "Invalid CPU for --busy-poll: " << argv[i] << endl;
+                return 1;
+            }
+            busy_cpu = (int)cpu;
+        } else if (strcmp(argv[i], "--max-jobs") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long n = strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n == 0 || n > (1u << 30)) {
+                cerr << "Invalid --max-jobs: " << argv[i] << endl;
+                return 1;
+            }
+            max_jobs = (uint32_t)n;
+            max_jobs_set = true;
+        } else if (strcmp(argv[i], "--job-memory") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long n = strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n == 0 || n > (1u << 20)) {
+                cerr << "Invalid --job-memory (MB): " << argv[i] << endl;
+                return 1;
+            }
+            job_memory_mb = n;
+        } else if ((strcmp(argv[i], "--ttl-min") == 0 || strcmp(argv[i], "--ttl-max") == 0) && i + 1 < argc) {
+            bool is_min = strcmp(argv[i], "--ttl-min") == 0;
+            char *end = nullptr;
+            double sec = strtod(argv[++i], &end);
+            if (*argv[i] == '\0' || *end != '\0' || !(sec >= 0.1 && sec <= 3600)) {
+                cerr << "Invalid " << (is_min ? "--ttl-min" : "--ttl-max") << " (seconds): " << argv[i] << endl;
+                return 1;
+            }
+            (is_min ? ttl_min_s : ttl_max_s) = sec;
+        } else if (strcmp(argv[i], "--overload") == 0) {
+            overload_mode = true;
+        } else if (strcmp(argv[i], "--overload-queue") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long n = strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n == 0 || n > (1u << 24)) {
+                cerr << "Invalid --overload-queue: " << argv[i] << endl;
+                return 1;
+            }
+            overload_queue = (uint32_t)n;
+        } else if (strcmp(argv[i], "--send-queue") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long n = strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n == 0 || n > (1u << 24)) {
+                cerr << "Invalid --send-queue: " << argv[i] << endl;
+                return 1;
+            }
+            send_queue = (uint32_t)n;
+        } else if (strcmp(argv[i], "--send-drop") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "newest") == 0) send_drop_policy = DROP_NEWEST;
+            else if (strcmp(argv[i], "oldest") == 0) send_drop_policy = DROP_OLDEST;
+            else {
+                cerr << "Invalid --send-drop (newest|oldest): " << argv[i] << endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--director") == 0) {
+            director_mode = true;
+        } else if (strcmp(argv[i], "--id-slice") == 0 && i + 1 < argc) {
+            unsigned k, n;
+            char extra;
+            if (sscanf(argv[++i], "%u/%u%c", &k, &n, &extra) != 2 || n == 0 || k >= n || n > 65536) {
+                cerr << "Invalid --id-slice (want K/N, 0 <= K < N): " << argv[i] << endl;
+                return 1;
+            }
+            cfg.id_prefix = k;
+            cfg.id_bits = slice_bits(n);
+        } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            journal_dir = argv[++i];
+        } else if (strcmp(argv[i], "--journal-segment") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long n = strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n == 0 || n > 65536) {
+                cerr << "Invalid --journal-segment (MB): " << argv[i] << endl;
+                return 1;
+            }
+            journal_segment_mb = n;
+        } else if (strcmp(argv[i], "--connected-peers") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long n = strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n > MAX_CONNECTED_PEERS) {
+                cerr << "Invalid --connected-peers (0.." << MAX_CONNECTED_PEERS << "): " << argv[i] << endl;
+                return 1;
+            }
+            max_peers = (uint32_t)n;
+        } else if (strcmp(argv[i], "--peer-rate") == 0 && i + 1 < argc) {
+            char *end = nullptr;
+            unsigned long n = strtoul(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n == 0 || n > (1u << 30)) {
+                cerr << "Invalid --peer-rate (datagrams/s): " << argv[i] << endl;
+                return 1;
+            }
+            peer_rate = (uint32_t)n;
+        } else if (strcmp(argv[i], "--no-gso") == 0) {
+            want_gso = false;
+        } else if (strcmp(argv[i], "--no-gro") == 0) {
+            want_gro = false;
+        } else {
+            usage = true;
+        }
+    }
+    if (usage) {
+        cerr << "Usage: " << argv[0] << " <IP:PORT> [--busy-poll CPU] [--max-jobs N] [--job-memory MB]"
+             << " [--ttl-min S] [--ttl-max S]"
+             << " [--overload] [--overload-queue N] [--send-queue N] [--send-drop newest|oldest]"
+             << " [--director] [--id-slice K/N] [--journal DIR] [--journal-segment MB]"
+             << " [--connected-peers N] [--peer-rate N] [--no-gso] [--no-gro]" << endl;
+        return 1;
+    }
+
+    if (ttl_min_s > ttl_max_s) {
+        cerr << "--ttl-min must not exceed --ttl-max" << endl;
+        return 1;
+    }
+    cfg.ttl_min = chrono::milliseconds((int64_t)(ttl_min_s * 1000));
+    cfg.ttl_max = chrono::milliseconds((int64_t)(ttl_max_s * 1000));
+    if (job_memory_mb) {
+        uint32_t fit = JobTable::capacity_for(job_memory_mb << 20);
+        if (fit == 0) {
+            cerr << "--job-memory too small for a single job" << endl;
+            return 1;
+        }
+        // The budget sizes the table, capped by --max-jobs if both are given.
+        if (!max_jobs_set || fit < max_jobs) max_jobs = fit;
+    }
+    cfg.max_jobs = max_jobs;
+    if ((1ull << (32 - cfg.id_bits)) <= max_jobs) {
+        cerr << "--id-slice leaves " << (1ull << (32 - cfg.id_bits))
+             << " job ids, not more than the job table's " << max_jobs << " slots; lower --max-jobs" << endl;
         return 1;
     }
 
     srand((unsigned)time(NULL));
     initCalcLib();
+#ifdef STAGE_TRACE
+    stage_tracer.calibrate();
+#endif
+    if (overload_mode) hello_queue.init(overload_queue);
+    send_backlog.init(send_queue);
+    // Threads inherit the affinity of the thread that starts them: keep the
+    // journal writer and the housekeeper off the busy-poll CPU from the
+    // start. run_busy_poll_loop() pins this thread onto it afterwards.
+    if (busy_cpu >= 0) avoid_cpu(busy_cpu);
+    if (journal_dir) {
+        if (!journal.open(journal_dir, journal_segment_mb << 20, JOURNAL_RING)) return 1;
+        journaling = true;
+        cfg.journal = &journal;
+    }
+    cfg.log = &cout;
+    cfg.job_log = &cerr;
+    if (!engine.init(cfg)) {
+        cerr << "Invalid job table configuration" << endl;
+        return 1;
+    }
 
     signal(SIGINT, handle_sig);
     signal(SIGTERM, handle_sig);
+    signal(SIGUSR1, handle_usr1);
 
     // parse host:port or [ipv6]:port
     string arg = argv[1];
@@ -170,185 +1276,41 @@ int main(int argc, char **argv) {
 
     freeaddrinfo(res);
 
-    cout << "Server started on " << host << ":" << port << endl;
-    fflush(stdout);
-
-    const size_t MSG_SZ = sizeof(struct calcMessage);
-    const size_t PROTO_SZ = sizeof(struct calcProtocol);
-    unsigned char buf[2048];
-
-    while (!stop_server) {
-        // Check for idle timeout
-        check_idle_timeout();
-        if (stop_server) break;
-
-        // cleanup timed out jobs (>=10s)
-        auto now = Clock::now();
-        vector<uint32_t> expired;
-        for (auto &kv : jobs) {
-            auto diff = chrono::duration_cast<chrono::seconds>(now - kv.second.ts).count();
-            if (diff >= 10) expired.push_back(kv.first);
-        }
-        for (uint32_t id : expired) {
-            cerr << "Job " << id << " timed out and removed." << endl;
-            jobs.erase(id);
-        }
-
-        // select waiting
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        FD_SET(srv_sock, &rfds);
-        timeval tv; tv.tv_sec = 0; tv.tv_usec = 200000; // 200ms
-        int sret = select(srv_sock+1, &rfds, nullptr, nullptr, &tv);
-        if (sret < 0) {
-            if (errno == EINTR) continue;
-            perror("select");
-            break;
-        }
-        if (sret == 0) continue; // loop to cleanup
-
-        // ready to read
-        sockaddr_storage cliaddr;
-        socklen_t cliaddr_len = sizeof(cliaddr);
-        ssize_t n = recvfrom(srv_sock, buf, sizeof(buf), 0, (sockaddr*)&cliaddr, &cliaddr_len);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            perror("recvfrom");
-            continue;
-        }
-
-        string client_str = addr_to_string(cliaddr);
-        cout << "Received " << n << " bytes from " << client_str << endl;
-        fflush(stdout);
-
-        if ((size_t)n == MSG_SZ) {
-            struct calcMessage cm;
-            memcpy(&cm, buf, MSG_SZ);
-
-            uint16_t cm_type = ntohs(cm.type);
-            uint32_t cm_message = ntohl(cm.message);
-            uint16_t cm_protocol = ntohs(cm.protocol);
-            uint16_t cm_maj = ntohs(cm.major_version);
-            uint16_t cm_min = ntohs(cm.minor_version);
-
-            if (!(cm_type == 22 && cm_message == 0 && cm_protocol == 17 && cm_maj == 1 && cm_min == 0)) {
-                cout << "ERROR WRONG SIZE OR INCORRECT PROTOCOL from " << client_str << endl;
-                fflush(stdout);
-                continue;
-            }
-
-            struct calcProtocol cp;
-            memset(&cp, 0, sizeof(cp));
-            cp.type = htons(1); // server -> client
-            cp.major_version = htons(1);
-            cp.minor_version = htons(0);
-
-            uint32_t id = new_id();
-            cp.id = htonl(id);
-
-            string op = randomType(); // "add","fadd",...
-            int arith = arith_code_from_name(op);
-            cp.arith = htonl(arith);
-
-            Job job(cliaddr, cliaddr_len, id, arith >= 5, 0, 0.0);
-
-            if (arith >= 1 && arith <= 4) {
-                int iv1 = randomInt(), iv2 = randomInt(), ires = 0;
-                if (arith == 1) ires = iv1 + iv2;
-                else if (arith == 2) ires = iv1 - iv2;
-                else if (arith == 3) ires = iv1 * iv2;
-                else if (arith == 4) ires = (iv2 == 0 ? 0 : (iv1 / iv2));
-                job.i_expected = ires;
-                cp.inValue1 = htonl(iv1);
-                cp.inValue2 = htonl(iv2);
-                cp.inResult = htonl(0); // don't reveal expected result
-            } else {
-                double f1 = randomFloat(), f2 = randomFloat(), fres = 0.0;
-                if (arith == 5) fres = f1 + f2;
-                else if (arith == 6) fres = f1 - f2;
-                else if (arith == 7) fres = f1 * f2;
-                else if (arith == 8) fres = (f2 == 0.0 ? 0.0 : (f1 / f2));
-                job.f_expected = fres;
-                cp.flValue1 = f1;
-                cp.flValue2 = f2;
-                cp.flResult = 0.0; // don't reveal expected result
-            }
-
-            jobs[id] = job;
-
-            ssize_t sent = sendto(srv_sock, &cp, sizeof(cp), 0, (sockaddr*)&cliaddr, cliaddr_len);
-            if (sent != (ssize_t)sizeof(cp)) {
-                perror("sendto assignment");
-            }
-            continue;
-        }
-
-        if ((size_t)n == PROTO_SZ) {
-            struct calcProtocol cp;
-            memcpy(&cp, buf, PROTO_SZ);
-
-            uint16_t type = ntohs(cp.type);
-            uint16_t maj = ntohs(cp.major_version);
-            uint16_t min = ntohs(cp.minor_version);
-            uint32_t id = ntohl(cp.id);
-
-            if (!(type == 2 && maj == 1 && min == 0)) {
-                cout << "ERROR WRONG SIZE OR INCORRECT PROTOCOL from " << client_str << endl;
-                continue;
-            }
-
-            auto it = jobs.find(id);
-            if (it == jobs.end()) {
-                calcMessage resp{};
-                resp.type = htons(1);
-                resp.message = htonl(2); // NOT OK
-                resp.protocol = htons(17);
-                resp.major_version = htons(1);
-                resp.minor_version = htons(0);
-                sendto(srv_sock, &resp, sizeof(resp), 0, (sockaddr*)&cliaddr, cliaddr_len);
-                continue;
-            }
-
-            if (!same_sockaddr(it->second.addr, cliaddr)) {
-                calcMessage resp{};
-                resp.type = htons(1);
-                resp.message = htonl(2); // NOT OK
-                resp.protocol = htons(17);
-                resp.major_version = htons(1);
-                resp.minor_version = htons(0);
-                sendto(srv_sock, &resp, sizeof(resp), 0, (sockaddr*)&cliaddr, cliaddr_len);
-                continue;
-            }
-
-            bool ok = false;
-            if (!it->second.is_float) {
-                int32_t client_res = (int32_t)ntohl((uint32_t)cp.inResult);
-                if (client_res == it->second.i_expected) ok = true;
-            } else {
-                double client_res = cp.flResult;
-                double diff = fabs(client_res - it->second.f_expected);
-                if (diff < 0.0001) ok = true;
-            }
-
-            jobs.erase(it);
+    int flags = fcntl(srv_sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(srv_sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl O_NONBLOCK");
+        close(srv_sock);
+        return 1;
+    }
 
-            calcMessage finalm{};
-            finalm.type = htons(1);
-            finalm.message = htonl(ok ? 1 : 2);
-            finalm.protocol = htons(17);
-            finalm.major_version = htons(1);
-            finalm.minor_version = htons(0);
+    cout << "Server started on " << host << ":" << port << endl;
+    negotiate_offloads(want_gso, want_gro);
 
-            ssize_t s = sendto(srv_sock, &finalm, sizeof(finalm), 0, (sockaddr*)&cliaddr, cliaddr_len);
-            if (s != (ssize_t)sizeof(finalm)) {
-                perror("sendto final");
-            }
-            continue;
-        }
+#ifndef SO_REUSEPORT
+    max_peers = 0;
+#endif
+    for (uint32_t i = 0; i < MAX_CONNECTED_PEERS; i++) peers[i].fd = -1;
+    srv_addrlen = sizeof(srv_addr);
+    if (max_peers && getsockname(srv_sock, (sockaddr*)&srv_addr, &srv_addrlen) < 0) {
+        perror("getsockname (connected peers off)");
+        max_peers = 0;
+    }
+    if (max_peers) {
+        cout << "Connected sockets for up to " << max_peers << " peers above "
+             << peer_rate << " datagrams/s" << endl;
+    }
+    peer_window_start = Clock::now();
+    fflush(stdout);
 
-        cout << "ERROR WRONG SIZE OR INCORRECT PROTOCOL from " << client_str << endl;
+    if (busy_cpu >= 0) {
+        run_busy_poll_loop(busy_cpu);
+    } else {
+        run_epoll_loop();
     }
 
+    journal.close();
+    dump_stats();
+    close_peers();
     if (srv_sock >= 0) close(srv_sock);
     return 0;
 }
@@ -0,0 +1,194 @@
+#ifndef __STAGE_TRACE
+#define __STAGE_TRACE
+
+/*
+   Per-stage timing of the server's packet pipeline. Header only, C++.
+
+   The pipeline is marked at stage boundaries: TRACE_MARK(s) charges the
+   time since the previous mark to stage <s>, so straight-line code with
+   early returns needs one mark per boundary and no scopes. TRACE_START()
+   resets the reference point without charging anything (e.g. after an
+   empty poll), and TRACE_COMMIT() turns what was charged since the last
+   commit into one sample per stage, so a stage that is entered twice while
+   handling one datagram still counts once.
+
+   Every TRACE_MARK is also a static SDT probe, calcserver:stage(stage id),
+   when <sys/sdt.h> is available: a single nop until perf or bpftrace
+   attaches, e.g.
+       bpftrace -e 'usdt:./server:calcserver:stage { @[arg0] = count(); }'
+
+   Timestamps and histograms only exist in builds with -DSTAGE_TRACE
+   (serverT); elsewhere the macros reduce to the probes.
+*/
+
+#include <stdint.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define STAGE_PROBE(s) DTRACE_PROBE1(calcserver, stage, (int)(s))
+#endif
+#endif
+#ifndef STAGE_PROBE
+#define STAGE_PROBE(s) do {} while(0)
+#endif
+
+enum Stage {
+  STAGE_RECV,     // recvmmsg()
+  STAGE_DECODE,   // GRO split, director framing, size/version checks
+  STAGE_LOG,      // address formatting and per-datagram logging
+  STAGE_TABLE,    // job table insert/find/erase, journal record
+  STAGE_COMPUTE,  // operand generation, expected result, verification
+  STAGE_ENCODE,   // building and staging the reply
+  STAGE_SEND,     // GSO grouping and sendmmsg(), backlog drain
+  STAGE_COUNT
+};
+
+static const char *const STAGE_NAMES[STAGE_COUNT] = {
+  "recv", "decode", "log", "table", "compute", "encode", "send"
+};
+
+#ifdef STAGE_TRACE
+
+#include <time.h>
+#include <iostream>
+#include <iomanip>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class StageTracer {
+public:
+    // Log-linear histogram of cycle counts: exact below 8, then 8 sub-buckets
+    // per power of two (within 12.5%).
+    static const int SUB_BITS = 3;
+    static const int BUCKETS = (1 << SUB_BITS) + (64 - SUB_BITS) * (1 << SUB_BITS);
+
+    StageTracer() : last(0), ns_per_tick(1.0) {
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            pending[s] = 0;
+            hist[s] = Hist();
+        }
+    }
+
+    static uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+    }
+
+    // Measure the tick rate against CLOCK_MONOTONIC; call once at startup.
+    void calibrate() {
+        timespec t0, t1, pause = {0, 20000000};
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t c0 = ticks();
+        nanosleep(&pause, nullptr);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        uint64_t c1 = ticks();
+        double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        if (c1 > c0) ns_per_tick = ns / (double)(c1 - c0);
+    }
+
+    void start() { last = ticks(); }
+
+    void mark(Stage s) {
+        uint64_t now = ticks();
+        pending[s] += now - last;
+        last = now;
+    }
+
+    void commit() {
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            if (pending[s] == 0) continue;
+            hist[s].add(pending[s]);
+            pending[s] = 0;
+        }
+    }
+
+    // One line per stage: samples, mean and percentiles in ns, share of the
+    // total traced time.
+    void dump(std::ostream &out) const {
+        uint64_t total = 0;
+        for (int s = 0; s < STAGE_COUNT; s++) total += hist[s].sum;
+        std::ios::fmtflags f = out.flags();
+        out << std::fixed << std::setprecision(0);
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            const Hist &h = hist[s];
+            out << "stage " << std::setw(8) << std::left << STAGE_NAMES[s] << std::right
+                << " samples=" << h.count
+                << " mean_ns=" << (h.count ? h.sum * ns_per_tick / h.count : 0.0)
+                << " p50_ns=" << h.percentile(0.50) * ns_per_tick
+                << " p99_ns=" << h.percentile(0.99) * ns_per_tick
+                << " max_ns=" << h.max * ns_per_tick
+                << std::setprecision(1)
+                << " share=" << (total ? 100.0 * h.sum / total : 0.0) << "%"
+                << std::setprecision(0) << std::endl;
+        }
+        out.flags(f);
+    }
+
+private:
+    struct Hist {
+        uint64_t count, sum, max;
+        uint64_t buckets[BUCKETS];
+
+        Hist() : count(0), sum(0), max(0), buckets() {}
+
+        static int bucket(uint64_t v) {
+            if (v < (1u << SUB_BITS)) return (int)v;
+            int e = 63 - __builtin_clzll(v);
+            int sub = (int)(v >> (e - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+            return (1 << SUB_BITS) + (e - SUB_BITS) * (1 << SUB_BITS) + sub;
+        }
+
+        // Lower bound of bucket <b>.
+        static uint64_t value(int b) {
+            if (b < (1 << SUB_BITS)) return b;
+            int e = (b - (1 << SUB_BITS)) / (1 << SUB_BITS) + SUB_BITS;
+            int sub = (b - (1 << SUB_BITS)) % (1 << SUB_BITS);
+            return (uint64_t)((1 << SUB_BITS) + sub) << (e - SUB_BITS);
+        }
+
+        void add(uint64_t v) {
+            count++;
+            sum += v;
+            if (v > max) max = v;
+            buckets[bucket(v)]++;
+        }
+
+        double percentile(double p) const {
+            if (count == 0) return 0.0;
+            uint64_t rank = (uint64_t)(p * (count - 1)), seen = 0;
+            for (int b = 0; b < BUCKETS; b++) {
+                seen += buckets[b];
+                if (seen > rank) return (double)value(b);
+            }
+            return (double)max;
+        }
+    };
+
+    uint64_t last;
+    double ns_per_tick;
+    uint64_t pending[STAGE_COUNT];
+    Hist hist[STAGE_COUNT];
+};
+
+inline StageTracer stage_tracer;
+
+#define TRACE_START() stage_tracer.start()
+#define TRACE_MARK(s) do { stage_tracer.mark(s); STAGE_PROBE(s); } while(0)
+#define TRACE_COMMIT() stage_tracer.commit()
+
+#else
+
+#define TRACE_START() do {} while(0)
+#define TRACE_MARK(s) STAGE_PROBE(s)
+#define TRACE_COMMIT() do {} while(0)
+
+#endif
+
+#endif